@@ -0,0 +1,671 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <fcntl.h>
+#include "BatchStripper.h"
+#include "IoUring.h"
+#include "MappedFile.h"
+#include "StripCache.h"
+#include "WorkStealingPool.h"
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace commentstripper {
+	namespace {
+		bool isCppSource(const fs::path& path) {
+			static const set<string> extensions{ ".c", ".cc", ".cpp", ".cxx", ".c++", ".h", ".hh", ".hpp", ".hxx", ".h++", ".inl", ".ipp", ".tpp" };
+			return extensions.count(path.extension().string()) != 0;
+		}
+
+		string readFile(const fs::path& path) {
+			ifstream is(path, ios::binary);
+			if (!is) {
+				throw runtime_error{"could not open input file"};
+			}
+
+			string s;
+			char buffer[64 * 1024];
+			while (is.read(buffer, sizeof buffer) || is.gcount()) {
+				s.append(buffer, static_cast<size_t>(is.gcount()));
+			}
+
+			if (is.bad()) {
+				throw runtime_error{"could not read input file"};
+			}
+
+			return s;
+		}
+
+		// Throws if writing file's output would go outside the output directory or overwrite its input.
+		void checkOutput(const BatchFile& file) {
+			if (file.output.empty()) {
+				throw runtime_error{"its output path would lead out of the output directory"};
+			}
+
+			error_code inputError, outputError;
+			fs::path input = fs::weakly_canonical(file.input, inputError);
+			fs::path output = fs::weakly_canonical(file.output, outputError);
+			if (!inputError && !outputError && input == output) {
+				throw runtime_error{"output file '" + file.output.string() + "' is the input file"};
+			}
+		}
+
+		// The whole input is needed up front for its key, so it is read into memory rather than streamed.
+		void stripFileCached(const BatchFile& file, StripStats* stats, StripCache& cache) {
+			string in = readFile(file.input);
+			string key = StripCache::key(in);
+			if (file.output.has_parent_path()) {
+				fs::create_directories(file.output.parent_path());
+			}
+
+			if (cache.fetch(key, file.output)) {
+				if (stats) {
+					error_code ec;
+					stats->inputBytes = in.size();
+					stats->outputBytes = fs::file_size(file.output, ec);
+				}
+
+				return;
+			}
+
+			string out;
+			if (stats) {
+				stripComments(in, out, *stats);
+			} else {
+				stripComments(in, out);
+			}
+
+			ofstream os(file.output, ios::binary);
+			os.write(out.data(), static_cast<streamsize>(out.size()));
+			os.close();
+			if (!os) {
+				throw runtime_error{"could not write output file '" + file.output.string() + "'"};
+			}
+
+			cache.insert(key, out);
+		}
+
+		void stripFile(const BatchFile& file, StripStats* stats, StripCache* cache) {
+			checkOutput(file);
+			if (cache) {
+				return stripFileCached(file, stats, *cache);
+			}
+
+			ifstream is(file.input);
+			if (!is) {
+				throw runtime_error{"could not open input file"};
+			}
+
+			if (file.output.has_parent_path()) {
+				fs::create_directories(file.output.parent_path());
+			}
+
+			ofstream os(file.output);
+			if (!os) {
+				throw runtime_error{"could not open output file '" + file.output.string() + "'"};
+			}
+
+			if (stats) {
+				stripComments(is, os, *stats);
+			} else {
+				stripComments(is, os);
+			}
+
+			os.close();
+			if (!os) {
+				throw runtime_error{"could not write output file '" + file.output.string() + "'"};
+			}
+		}
+	}
+
+	namespace {
+		// Empty if path, once normalised, climbs out of where it is relative to (e.g. ../a.cpp).
+		fs::path mirror(const fs::path& path, const fs::path& outputDir) {
+			fs::path relative = path.lexically_normal().relative_path();
+			if (!relative.empty() && *relative.begin() == "..") {
+				return {};
+			}
+
+			return outputDir / relative;
+		}
+	}
+
+	vector<BatchFile> collectBatchFiles(const vector<fs::path>& paths, const fs::path& outputDir) {
+		vector<BatchFile> files;
+		for (const fs::path& path : paths) {
+			if (fs::is_directory(path)) {
+				for (const auto& entry : fs::recursive_directory_iterator(path, fs::directory_options::skip_permission_denied)) {
+					if (entry.is_regular_file() && isCppSource(entry.path())) {
+						files.push_back({ entry.path(), mirror(entry.path(), outputDir) });
+					}
+				}
+			} else {
+				files.push_back({ path, mirror(path, outputDir) });
+			}
+		}
+
+		return files;
+	}
+
+	namespace {
+		struct SizedFile {
+			uintmax_t size;	// 0 if unknown
+			const BatchFile* file;
+		};
+
+		// Largest first, to avoid a long tail of one thread working on a huge file alone at the end.
+		vector<SizedFile> largestFirst(const vector<BatchFile>& files) {
+			vector<SizedFile> bySize;
+			for (const BatchFile& file : files) {
+				error_code ec;
+				uintmax_t size = fs::file_size(file.input, ec);
+				bySize.push_back({ ec ? 0 : size, &file });
+			}
+
+			stable_sort(bySize.begin(), bySize.end(), [](const SizedFile& a, const SizedFile& b) { return a.size > b.size; });
+			return bySize;
+		}
+
+		vector<BatchFailure> stripFilesBlocking(const vector<BatchFile>& files, unsigned nThreads, vector<StripStats>* stats,
+			StripCache* cache) {
+			vector<BatchFailure> failures;
+			mutex failuresMutex;
+			vector<function<void()>> tasks;
+			for (const SizedFile& sized : largestFirst(files)) {
+				const BatchFile& file = *sized.file;
+				StripStats* fileStats = stats ? &(*stats)[&file - files.data()] : nullptr;
+				tasks.push_back([&file, fileStats, cache, &failures, &failuresMutex] {
+					try {
+						stripFile(file, fileStats, cache);
+					} catch (exception& e) {
+						lock_guard<mutex> lock(failuresMutex);
+						failures.push_back({ file.input, e.what() });
+					}
+				});
+			}
+
+			WorkStealingPool(nThreads).run(move(tasks));
+			return failures;
+		}
+
+		// io_uring batch stripping. Each thread has its own ring, and keeps up to maxInFlight files moving through
+		// open, read, close, strip, open, write, close. Every file has at most one request outstanding, and the requests
+		// for all of them go to the kernel in a single io_uring_enter(), which is what makes many small files cheap.
+		// Stripping happens on the same thread as soon as a file's read completes. Threads claim files largest first
+		// from a shared counter. With a cache, hits are read from it (with ordinary blocking reads) in place of stripping,
+		// and the output is then written through the ring as usual. Anything a file's step throws fails just that file.
+		// Should a ring itself fail, its thread waits out what the kernel still has, then strips the rest of its files
+		// the blocking way.
+		const unsigned maxInFlight = 32;
+
+		enum class Step : uint64_t {
+			OPEN_INPUT,
+			READ,
+			CLOSE_INPUT,
+			OPEN_OUTPUT,
+			WRITE,
+			CLOSE_OUTPUT,
+			CLOSE_AFTER_FAILURE
+		};
+
+		struct Slot {
+			const BatchFile* file = nullptr;	// None if the slot is free
+			StripStats* stats;
+			string inputPath;	// Must outlive the open request
+			string outputPath;
+			int fd = -1;
+			string in;
+			string out;
+			size_t nDone = 0;	// Bytes read or written so far
+			string error;
+			bool pending = false;	// Is a request for the slot in the kernel?
+		};
+
+		class UringWorker {
+		public:
+			UringWorker(IoUring& ring, const vector<SizedFile>& work, atomic<size_t>& nextWork, const vector<BatchFile>& files,
+				vector<StripStats>* stats, StripCache* cache, vector<BatchFailure>& failures, mutex& failuresMutex)
+				: ring(ring), work(work), nextWork(nextWork), files(files), stats(stats), cache(cache), failures(failures),
+				failuresMutex(failuresMutex), slots(make_unique<Slot[]>(maxInFlight)) {
+				for (unsigned i = 0; i < maxInFlight; ++i) {
+					freeSlots.push_back(maxInFlight - 1 - i);
+				}
+			}
+
+			void run() {
+				try {
+					for (;;) {
+						while (!freeSlots.empty()) {
+							size_t i = nextWork++;
+							if (i >= work.size()) {
+								break;
+							}
+
+							start(work[i]);
+						}
+
+						if (freeSlots.size() == maxInFlight) {
+							return;
+						}
+
+						ring.submitAndWait(1);
+						ring.reap([this](uint64_t userData, int32_t result) {
+							size_t i = userData >> 3;
+							slots[i].pending = false;
+							try {
+								advance(i, static_cast<Step>(userData & 7), result);
+							} catch (exception& e) {
+								fail(i, e.what());
+							}
+						});
+					}
+				} catch (exception& e) {
+					abandonRing(e.what());
+				}
+			}
+
+		private:
+			// Each step queues at most one request for its file, and does so last, so a file whose step throws has
+			// nothing in the kernel, and can simply fail.
+			void start(const SizedFile& sized) {
+				size_t i = freeSlots.back();
+				freeSlots.pop_back();
+				Slot& slot = slots[i];
+				slot.file = sized.file;
+				slot.stats = statsFor(*sized.file);
+				slot.nDone = 0;
+				slot.error.clear();
+				try {
+					checkOutput(*sized.file);
+					slot.inputPath = sized.file->input.string();
+					slot.outputPath = sized.file->output.string();
+					slot.in.resize(static_cast<size_t>(sized.size) + 1);	// One more, so that the read finding the end has room
+				} catch (exception& e) {
+					return fail(i, e.what());
+				}
+
+				queue(i, ring.prepOpen(slot.inputPath.c_str(), O_RDONLY | O_CLOEXEC, 0, tag(i, Step::OPEN_INPUT)));
+			}
+
+			void advance(size_t i, Step step, int32_t result) {
+				Slot& slot = slots[i];
+				switch (step) {
+				case Step::OPEN_INPUT:
+					if (result < 0) {
+						return fail(i, "could not open input file");
+					}
+
+					slot.fd = result;
+					return readMore(i);
+
+				case Step::READ:
+					if (result < 0) {
+						return fail(i, string("could not read input file: ") + strerror(-result));
+					}
+
+					if (result == 0) {		// Only this means end of file: reads are capped, and may return less anyway
+						slot.in.resize(slot.nDone);
+						queue(i, ring.prepClose(slot.fd, tag(i, Step::CLOSE_INPUT)));
+						slot.fd = -1;
+						return;
+					}
+
+					slot.nDone += result;
+					if (slot.nDone == slot.in.size()) {	// The file grew since we asked its size
+						slot.in.resize(slot.in.size() * 2);
+					}
+
+					return readMore(i);
+
+				case Step::CLOSE_INPUT:
+					return stripAndOpenOutput(i);
+
+				case Step::OPEN_OUTPUT:
+					if (result < 0) {
+						return fail(i, "could not open output file '" + slot.outputPath + "'");
+					}
+
+					slot.fd = result;
+					slot.nDone = 0;
+					return writeMore(i);
+
+				case Step::WRITE:
+					if (result < 0) {
+						return fail(i, "could not write output file '" + slot.outputPath + "'");
+					}
+
+					slot.nDone += result;
+					return writeMore(i);
+
+				case Step::CLOSE_OUTPUT:
+					if (result < 0) {
+						slot.error = "could not write output file '" + slot.outputPath + "'";
+					}
+					// Fall through
+				case Step::CLOSE_AFTER_FAILURE:
+					return finish(i);
+				}
+			}
+
+			void readMore(size_t i) {
+				Slot& slot = slots[i];
+				unsigned n = static_cast<unsigned>(min<size_t>(slot.in.size() - slot.nDone, 1u << 30));
+				queue(i, ring.prepRead(slot.fd, &slot.in[slot.nDone], n, slot.nDone, tag(i, Step::READ)));
+			}
+
+			void stripAndOpenOutput(size_t i) {
+				Slot& slot = slots[i];
+				slot.out.clear();
+				string key = cache ? StripCache::key(slot.in) : string();
+				if (cache && cache->fetch(key, slot.out)) {
+					if (slot.stats) {
+						slot.stats->inputBytes = slot.in.size();
+						slot.stats->outputBytes = slot.out.size();
+					}
+				} else {
+					if (slot.stats) {
+						stripComments(slot.in, slot.out, *slot.stats);
+					} else {
+						stripComments(slot.in, slot.out);
+					}
+
+					if (cache) {
+						cache->insert(key, slot.out);
+					}
+				}
+
+				fs::path directory = slot.file->output.parent_path();
+				if (!directory.empty() && directory != lastDirectory) {	// Files in the same directory tend to be adjacent
+					fs::create_directories(directory);
+					lastDirectory = directory;
+				}
+
+				queue(i, ring.prepOpen(slot.outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666, tag(i, Step::OPEN_OUTPUT)));
+			}
+
+			void writeMore(size_t i) {
+				Slot& slot = slots[i];
+				if (slot.nDone == slot.out.size()) {
+					queue(i, ring.prepClose(slot.fd, tag(i, Step::CLOSE_OUTPUT)));
+					slot.fd = -1;
+					return;
+				}
+
+				unsigned n = static_cast<unsigned>(min<size_t>(slot.out.size() - slot.nDone, 1u << 30));
+				queue(i, ring.prepWrite(slot.fd, slot.out.data() + slot.nDone, n, slot.nDone, tag(i, Step::WRITE)));
+			}
+
+			void fail(size_t i, const string& reason) {
+				Slot& slot = slots[i];
+				slot.error = reason;
+				if (slot.fd >= 0) {
+					queue(i, ring.prepClose(slot.fd, tag(i, Step::CLOSE_AFTER_FAILURE)));
+					slot.fd = -1;
+				} else {
+					finish(i);
+				}
+			}
+
+			void finish(size_t i) {
+				Slot& slot = slots[i];
+				if (!slot.error.empty()) {
+					addFailure(*slot.file, slot.error);
+				}
+
+				string().swap(slot.in);	// Don't hold on to the largest file's buffers for the rest of the batch
+				string().swap(slot.out);
+				slot.file = nullptr;
+				freeSlots.push_back(i);
+			}
+
+			// After the ring has failed with reason: waits for every request still in the kernel, so that none completes
+			// into a freed buffer, then strips the files that were in progress, and those not yet claimed, the blocking
+			// way. If the ring can't even be waited on, the slots are leaked instead, and their files fail.
+			void abandonRing(const string& reason) {
+				bool drained = drain();
+				for (size_t i = 0; i < maxInFlight; ++i) {
+					if (slots[i].file) {
+						if (drained) {
+							stripBlocking(*slots[i].file);
+						} else {
+							addFailure(*slots[i].file, "io_uring failed: " + reason);
+						}
+					}
+				}
+
+				if (!drained) {
+					slots.release();	// Deliberately leaked: the kernel may yet write into them
+				}
+
+				for (size_t i; (i = nextWork++) < work.size(); ) {
+					stripBlocking(*work[i].file);
+				}
+			}
+
+			// Reaps until no request is pending, closing whatever files they leave open. Returns false if the ring fails
+			// again.
+			bool drain() {
+				try {
+					for (;;) {
+						bool anyPending = false;
+						for (size_t i = 0; i < maxInFlight; ++i) {
+							Slot& slot = slots[i];
+							if (!slot.pending && slot.fd >= 0) {
+								queue(i, ring.prepClose(slot.fd, tag(i, Step::CLOSE_AFTER_FAILURE)));
+								slot.fd = -1;
+							}
+
+							anyPending = anyPending || slot.pending;
+						}
+
+						if (!anyPending) {
+							return true;
+						}
+
+						ring.submitAndWait(1);
+						ring.reap([this](uint64_t userData, int32_t result) {
+							Slot& slot = slots[userData >> 3];
+							Step step = static_cast<Step>(userData & 7);
+							slot.pending = false;
+							if ((step == Step::OPEN_INPUT || step == Step::OPEN_OUTPUT) && result >= 0) {
+								slot.fd = result;
+							}
+						});
+					}
+				} catch (exception&) {
+					return false;
+				}
+			}
+
+			void stripBlocking(const BatchFile& file) {
+				StripStats* fileStats = statsFor(file);
+				try {
+					if (fileStats) {
+						*fileStats = StripStats();	// Drop whatever a half-done attempt counted
+					}
+
+					stripFile(file, fileStats, cache);
+				} catch (exception& e) {
+					addFailure(file, e.what());
+				}
+			}
+
+			void addFailure(const BatchFile& file, const string& reason) {
+				lock_guard<mutex> lock(failuresMutex);
+				failures.push_back({ file.input, reason });
+			}
+
+			StripStats* statsFor(const BatchFile& file) const {
+				return stats ? &(*stats)[&file - files.data()] : nullptr;
+			}
+
+			static uint64_t tag(size_t i, Step step) {
+				return static_cast<uint64_t>(i) << 3 | static_cast<uint64_t>(step);
+			}
+
+			// Each file has at most one request outstanding, and the ring has room for twice that many, so it never fills.
+			void queue(size_t i, bool queued) {
+				if (!queued) {
+					throw logic_error{"io_uring submission queue unexpectedly full"};
+				}
+
+				slots[i].pending = true;
+			}
+
+			IoUring& ring;
+			const vector<SizedFile>& work;
+			atomic<size_t>& nextWork;
+			const vector<BatchFile>& files;
+			vector<StripStats>* stats;
+			StripCache* cache;
+			vector<BatchFailure>& failures;
+			mutex& failuresMutex;
+			unique_ptr<Slot[]> slots;
+			vector<size_t> freeSlots;
+			fs::path lastDirectory;	// Known to exist
+		};
+
+		// Returns false, having done nothing, if io_uring is unavailable.
+		bool stripFilesUring(const vector<BatchFile>& files, unsigned nThreads, vector<StripStats>* stats, StripCache* cache,
+			vector<BatchFailure>& failures) {
+			vector<unique_ptr<IoUring>> rings;	// One per thread, and no more threads than files
+			for (size_t t = 0; t < max<size_t>(min<size_t>(nThreads, files.size()), 1); ++t) {
+				rings.push_back(make_unique<IoUring>(2 * maxInFlight));
+				if (!rings.back()->available()) {
+					if (t == 0) {
+						return false;
+					}
+
+					rings.pop_back();	// Use as many as we could get
+					break;
+				}
+			}
+
+			vector<SizedFile> work = largestFirst(files);
+			atomic<size_t> nextWork{ 0 };
+			mutex failuresMutex;
+			vector<exception_ptr> errors(rings.size());
+			auto runWorker = [&](size_t t) {
+				try {
+					UringWorker(*rings[t], work, nextWork, files, stats, cache, failures, failuresMutex).run();
+				} catch (...) {
+					errors[t] = current_exception();
+				}
+			};
+
+			vector<thread> threads;
+			try {
+				for (size_t t = 1; t < rings.size(); ++t) {
+					threads.emplace_back(runWorker, t);
+				}
+			} catch (...) {
+				for (thread& th : threads) {
+					th.join();
+				}
+				throw;
+			}
+
+			runWorker(0);
+			for (thread& th : threads) {
+				th.join();
+			}
+
+			for (const exception_ptr& error : errors) {
+				if (error) {
+					rethrow_exception(error);
+				}
+			}
+
+			return true;
+		}
+	}
+
+	vector<BatchFailure> stripFiles(const vector<BatchFile>& files, unsigned nThreads, vector<StripStats>* stats, BatchIo io,
+		StripCache* cache) {
+		if (stats) {
+			stats->assign(files.size(), StripStats());
+		}
+
+		vector<BatchFailure> failures;
+		if (io != BatchIo::IO_URING || !stripFilesUring(files, nThreads, stats, cache, failures)) {
+			failures = stripFilesBlocking(files, nThreads, stats, cache);
+		}
+
+		if (cache) {
+			cache->evict();
+		}
+
+		sort(failures.begin(), failures.end(), [](const BatchFailure& a, const BatchFailure& b) { return a.input < b.input; });
+		return failures;
+	}
+
+	namespace {
+		// Calls query(i) for each input on nThreads threads, collecting what it throws as failures.
+		template <typename Query>
+		vector<BatchFailure> queryFiles(const vector<fs::path>& inputs, unsigned nThreads, Query query) {
+			vector<BatchFailure> failures;
+			mutex failuresMutex;
+			vector<function<void()>> tasks;
+			for (size_t i = 0; i < inputs.size(); ++i) {
+				tasks.push_back([&, i] {
+					try {
+						query(i);
+					} catch (exception& e) {
+						lock_guard<mutex> lock(failuresMutex);
+						failures.push_back({ inputs[i], e.what() });
+					}
+				});
+			}
+
+			WorkStealingPool(nThreads).run(move(tasks));
+			sort(failures.begin(), failures.end(), [](const BatchFailure& a, const BatchFailure& b) { return a.input < b.input; });
+			return failures;
+		}
+
+		ifstream openInput(const fs::path& path) {
+			ifstream is(path, ios::binary);
+			if (!is) {
+				throw runtime_error{"could not open input file"};
+			}
+
+			return is;
+		}
+	}
+
+	vector<BatchFailure> fingerprintFiles(const vector<fs::path>& inputs, unsigned nThreads, vector<uint64_t>& digests) {
+		digests.assign(inputs.size(), 0);
+		return queryFiles(inputs, nThreads, [&](size_t i) {
+			MappedFile mapped(inputs[i].string());
+			if (mapped.isMapped()) {
+				digests[i] = fingerprint(mapped.contents());
+			} else {
+				ifstream is = openInput(inputs[i]);
+				digests[i] = fingerprint(is);
+			}
+		});
+	}
+
+	// Streamed rather than mapped: mapping reads the whole file up front, but most of it may never be needed.
+	vector<BatchFailure> findFirstComments(const vector<fs::path>& inputs, unsigned nThreads,
+		vector<optional<SourceLocation>>& firstComments) {
+		firstComments.assign(inputs.size(), nullopt);
+		return queryFiles(inputs, nThreads, [&](size_t i) {
+			ifstream is = openInput(inputs[i]);
+			firstComments[i] = findFirstComment(is);
+		});
+	}
+}
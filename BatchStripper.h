@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+#include "CommentStripper.h"
+
+namespace commentstripper {
+	class StripCache;
+
+	struct BatchFile {
+		std::filesystem::path input;
+		std::filesystem::path output;
+	};
+
+	struct BatchFailure {
+		std::filesystem::path input;
+		std::string reason;
+	};
+
+	enum class BatchIo {
+		BLOCKING,	// An ifstream and ofstream per file, on a work-stealing pool
+		IO_URING	// Opens, reads, writes and closes for many files batched through io_uring; BLOCKING where unavailable
+	};
+
+	/**
+	 * Lists the files named by paths, each of which may be a file or a directory. Directories are walked recursively
+	 * for C and C++ sources and headers; named files are always included. Each output path mirrors its input path
+	 * (normalised, minus any root) under outputDir. An input whose path leads out of where it was named from (e.g.
+	 * ../a.cpp) has no such mirror, so is given an empty output path, which stripFiles() reports as a failure.
+	 */
+	std::vector<BatchFile> collectBatchFiles(const std::vector<std::filesystem::path>& paths,
+		const std::filesystem::path& outputDir);
+
+	/**
+	 * Strips comments from each file's input into its output, creating directories as needed, using nThreads threads.
+	 * The largest files are started first, to avoid a long tail of one thread working on a huge file alone at the end.
+	 * A failure on one file doesn't stop the others; all failures are returned. A file whose output path is empty, or
+	 * is its input once symlinks and the like are resolved, is a failure rather than overwritten. If stats is given,
+	 * (*stats)[i] is set to what stripping files[i] involved.
+	 *
+	 * If cache is given, outputs are taken from it where possible instead of stripping; for those, only inputBytes and
+	 * outputBytes are set in stats. New outputs are added to it, and it is trimmed to size at the end.
+	 */
+	std::vector<BatchFailure> stripFiles(const std::vector<BatchFile>& files, unsigned nThreads,
+		std::vector<StripStats>* stats = nullptr, BatchIo io = BatchIo::BLOCKING, StripCache* cache = nullptr);
+
+	/**
+	 * Sets digests[i] to fingerprint() of inputs[i], using nThreads threads. Nothing is written. Inputs that can't be
+	 * read are left with a digest of 0 and returned as failures.
+	 */
+	std::vector<BatchFailure> fingerprintFiles(const std::vector<std::filesystem::path>& inputs, unsigned nThreads,
+		std::vector<std::uint64_t>& digests);
+
+	/**
+	 * Sets firstComments[i] to findFirstComment() of inputs[i], using nThreads threads. Inputs that can't be read are
+	 * left with nullopt and returned as failures.
+	 */
+	std::vector<BatchFailure> findFirstComments(const std::vector<std::filesystem::path>& inputs, unsigned nThreads,
+		std::vector<std::optional<SourceLocation>>& firstComments);
+}
@@ -0,0 +1,232 @@
+#include "ByteScanner.h"
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64)	// SSE2 is part of the baseline instruction set
+#define COMMENTSTRIPPER_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define COMMENTSTRIPPER_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define COMMENTSTRIPPER_TARGET_AVX2	// MSVC emits any intrinsic regardless of /arch
+#endif
+
+using namespace std;
+
+namespace commentstripper {
+	namespace {
+		inline bool isNeedle(char x, char a, char b, char c, char d) {
+			return x == a || x == b || x == c || x == d;
+		}
+
+		const char* findFirstOfScalar(const char* p, const char* end, char a, char b, char c, char d) {
+			while (p != end && !isNeedle(*p, a, b, c, d)) {
+				++p;
+			}
+
+			return p;
+		}
+
+		// Whether a backslash followed by [after, end) ends a line: it is followed by a newline or a CR LF, or by too few bytes
+		// to tell.
+		inline bool endsLine(const char* after, const char* end) {
+			return after == end || *after == '\n' || (*after == '\r' && (after + 1 == end || after[1] == '\n'));
+		}
+
+		const char* findBackslashNewlineScalar(const char* p, const char* end) {
+			for (; p != end; ++p) {
+				if (*p == '\\' && endsLine(p + 1, end)) {
+					break;
+				}
+			}
+
+			return p;
+		}
+
+#ifdef COMMENTSTRIPPER_X86
+		inline unsigned countTrailingZeros(unsigned mask) {
+#ifdef _MSC_VER
+			unsigned long i;
+			_BitScanForward(&i, mask);
+			return i;
+#else
+			return __builtin_ctz(mask);
+#endif
+		}
+
+		inline unsigned countTrailingZeros64(uint64_t mask) {
+#ifdef _MSC_VER
+			unsigned long i;
+			_BitScanForward64(&i, mask);
+			return i;
+#else
+			return static_cast<unsigned>(__builtin_ctzll(mask));
+#endif
+		}
+
+		// Returns the first backslash flagged in mask (bit i for block[i]) that really ends a line, or nullptr.
+		inline const char* confirmBackslashNewline(const char* block, uint64_t mask, const char* end) {
+			for (; mask; mask &= mask - 1) {
+				const char* p = block + countTrailingZeros64(mask);
+				if (endsLine(p + 1, end)) {
+					return p;
+				}
+			}
+
+			return nullptr;
+		}
+
+		// Bit i is set iff p[i] is a backslash and p[i + 1] is a newline or a CR. Reads p[0..16]. A CR not followed by a newline
+		// is rare enough to be weeded out by confirmBackslashNewline() rather than by a third comparison here.
+		inline unsigned backslashNewlineMaskSse2(const char* p) {
+			__m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+			__m128i backslashes = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), _mm_set1_epi8('\\'));
+			__m128i newlines = _mm_or_si128(_mm_cmpeq_epi8(next, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(next, _mm_set1_epi8('\r')));
+			return static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(backslashes, newlines)));
+		}
+
+		const char* findBackslashNewlineSse2(const char* p, const char* end) {
+			for (; end - p > 64; p += 64) {	// Strictly greater, so the lookahead byte p[64] exists
+				uint64_t any = backslashNewlineMaskSse2(p) | uint64_t(backslashNewlineMaskSse2(p + 16)) << 16 |
+					uint64_t(backslashNewlineMaskSse2(p + 32)) << 32 | uint64_t(backslashNewlineMaskSse2(p + 48)) << 48;
+				if (any) {
+					if (const char* q = confirmBackslashNewline(p, any, end)) {
+						return q;
+					}
+				}
+			}
+
+			return findBackslashNewlineScalar(p, end);
+		}
+
+		const char* findFirstOfSse2(const char* p, const char* end, char a, char b, char c, char d) {
+			const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b), vc = _mm_set1_epi8(c), vd = _mm_set1_epi8(d);
+
+			for (; end - p >= 16; p += 16) {
+				__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+				__m128i hits = _mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb)),
+					_mm_or_si128(_mm_cmpeq_epi8(x, vc), _mm_cmpeq_epi8(x, vd)));
+				unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hits));
+				if (mask) {
+					return p + countTrailingZeros(mask);
+				}
+			}
+
+			return findFirstOfScalar(p, end, a, b, c, d);
+		}
+
+		COMMENTSTRIPPER_TARGET_AVX2
+		const char* findFirstOfAvx2(const char* p, const char* end, char a, char b, char c, char d) {
+			const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b), vc = _mm256_set1_epi8(c), vd = _mm256_set1_epi8(d);
+
+			for (; end - p >= 32; p += 32) {
+				__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+				__m256i hits = _mm256_or_si256(
+					_mm256_or_si256(_mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(x, vb)),
+					_mm256_or_si256(_mm256_cmpeq_epi8(x, vc), _mm256_cmpeq_epi8(x, vd)));
+				unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hits));
+				if (mask) {
+					return p + countTrailingZeros(mask);
+				}
+			}
+
+			return findFirstOfSse2(p, end, a, b, c, d);
+		}
+
+		COMMENTSTRIPPER_TARGET_AVX2
+		inline unsigned backslashNewlineMaskAvx2(const char* p) {
+			__m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+			__m256i backslashes = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), _mm256_set1_epi8('\\'));
+			__m256i newlines = _mm256_or_si256(_mm256_cmpeq_epi8(next, _mm256_set1_epi8('\n')),
+				_mm256_cmpeq_epi8(next, _mm256_set1_epi8('\r')));
+			return static_cast<unsigned>(_mm256_movemask_epi8(_mm256_and_si256(backslashes, newlines)));
+		}
+
+		COMMENTSTRIPPER_TARGET_AVX2
+		const char* findBackslashNewlineAvx2(const char* p, const char* end) {
+			for (; end - p > 64; p += 64) {
+				uint64_t any = backslashNewlineMaskAvx2(p) | uint64_t(backslashNewlineMaskAvx2(p + 32)) << 32;
+				if (any) {
+					if (const char* q = confirmBackslashNewline(p, any, end)) {
+						return q;
+					}
+				}
+			}
+
+			return findBackslashNewlineScalar(p, end);
+		}
+
+		bool cpuHasAvx2() {
+#ifdef _MSC_VER
+			int regs[4];
+			__cpuid(regs, 1);
+			bool osSavesYmm = (regs[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;	// OSXSAVE, then XMM and YMM state enabled
+			__cpuidex(regs, 7, 0);
+			return osSavesYmm && (regs[1] & (1 << 5));
+#else
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2");
+#endif
+		}
+#endif
+
+		struct Kernels {
+			const char* (*findFirstOf)(const char*, const char*, char, char, char, char);
+			const char* (*findBackslashNewline)(const char*, const char*);
+		};
+
+		Kernels chooseKernels() {
+#ifdef COMMENTSTRIPPER_X86
+			if (cpuHasAvx2()) {
+				return { findFirstOfAvx2, findBackslashNewlineAvx2 };
+			}
+
+			return { findFirstOfSse2, findBackslashNewlineSse2 };
+#else
+			return { findFirstOfScalar, findBackslashNewlineScalar };
+#endif
+		}
+
+		const Kernels& kernels() {
+			static const Kernels k = chooseKernels();	// Function-local so it is safe to call during static init
+			return k;
+		}
+	}
+
+	const char* findFirstOf(const char* p, const char* end, char a, char b, char c, char d) {
+		return kernels().findFirstOf(p, end, a, b, c, d);
+	}
+
+	const char* findBackslashNewline(const char* p, const char* end) {
+		return kernels().findBackslashNewline(p, end);
+	}
+
+	// Memory bound, so SSE2 (part of the x86-64 baseline) does as well as anything, and needs no dispatch.
+	size_t countByte(const char* p, const char* end, char c) {
+		size_t n = 0;
+#ifdef COMMENTSTRIPPER_X86
+		const __m128i vc = _mm_set1_epi8(c);
+		while (end - p >= 16) {
+			// Each byte lane counts its matches (a match is -1, so subtract it), for up to 255 vectors before it could
+			// overflow; then the lanes are summed
+			__m128i counts = _mm_setzero_si128();
+			for (int i = 0; i < 255 && end - p >= 16; ++i, p += 16) {
+				counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), vc));
+			}
+
+			__m128i sums = _mm_sad_epu8(counts, _mm_setzero_si128());
+			n += static_cast<size_t>(_mm_cvtsi128_si32(sums)) + static_cast<size_t>(_mm_extract_epi16(sums, 4));
+		}
+#endif
+		for (; p != end; ++p) {
+			n += (*p == c);
+		}
+
+		return n;
+	}
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+
+namespace commentstripper {
+	/**
+	 * Returns a pointer to the first byte in [p, end) equal to any of a, b, c or d, or end if there is none.
+	 * Pass the same needle more than once to search for fewer than 4 distinct bytes.
+	 * Uses the widest vector instructions (AVX2, SSE2) the CPU supports, chosen once at startup, with a scalar fallback.
+	 */
+	const char* findFirstOf(const char* p, const char* end, char a, char b, char c, char d);
+
+	/**
+	 * Returns a pointer to the first backslash in [p, end) that is followed by a newline or a CR LF, or that is followed
+	 * by too few bytes to tell, and so might be in the next block of input; or end if there is none. Works through 64-byte
+	 * blocks, looking at each byte individually only in the block containing the match.
+	 */
+	const char* findBackslashNewline(const char* p, const char* end);
+
+	/**
+	 * Returns the number of bytes in [p, end) equal to c, e.g. to count lines. Uses SSE2 where available.
+	 */
+	std::size_t countByte(const char* p, const char* end, char c);
+}
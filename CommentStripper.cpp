@@ -2,273 +2,1148 @@
 #include <cctype>
 #include <iostream>
 #include <stdexcept>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <utility>
+#include "CommentStripper.h"
+#include "SpscRing.h"
+#include "Xxh64.h"
 
 using namespace std;
 
 namespace commentstripper {
-	// Line continuation with <backslash><newline> complicates parsing, since any number of these pairs can appear even in the
-	// middle of a "//" single-line comment marker ("|" chars below just show the "page boundary"):
-	//
-	// |// Ordinary single-line comment                                  |
-	// |                                                                 |
-	// |/\                                                               |
-	// |/ Single-line comment with comment marker split over 2 lines!    |
-	// |int some_code;   /\                                              |
-	// |\                                                                |
-	// |\                                                                |
-	// |/ Another single\                                                |
-	// | line com\                                                       |
-	// |ment!                                                            |
-	// |float more_code;                                                 |
-	//
-	// Another quirk is that these pairs are parsed at a different level than the backslashes used in string and character
-	// literals, so, e.g.:
-	//
-	// |cout << "Line with one backslash\                                |
-	// |x41<--there." << endl;                                           |
-	// |cout << "Line with two backslashes\\                             |
-	// |x41<--there." << endl;                                           |
-	// |cout << "Line with three backslashes\\\                          |
-	// |x41<--there." << endl;                                           |
-	//
-	// produces:
-	//
-	// |Line with one backslashx41<--there.                              |
-	// |Line with two backslashesA<--there.                              |
-	// |Line with three backslashes\x41<--there.                         |
-	//
-	// (Note in particular that the final backslash on the line ending with two backslashes retains its line-continuing
-	// power, and the escape sequence begun by its first backslash continues on the second line, resulting in "\x41" == "A".)
-	//
-	// To reproduce all these <backslash><newline> pairs in the output while bounding memory usage, we treat the input not as
-	// a sequence of characters but as a sequence of (nBackslashNewlinePairs, char) pairs, with nBackslashNewlinePairs
-	// most of the time being 0.
-	class BackslashNewlineReader {
+	// Adds what a BasicStripper sees to a StripStats.
+	class CountingStats {
 	public:
-		BackslashNewlineReader(istream& is) : is(is), nBackslashNewlinePairs(0), backslash(false), lookedAhead(false), lookaheadBuf() {}
+		explicit CountingStats(StripStats& stats) : stats(&stats) {}
+		void countBytes(State s, uint64_t n) { stats->bytesInState[static_cast<size_t>(s)] += n; }
+		void countPairs(unsigned n) { stats->continuationPairs += n; }
+		void countComment() { ++stats->commentsRemoved; }
+		void commentText(const BackslashNewlines&, const char*, size_t) {}
+		void commentEnded() {}
 
-		pair<unsigned, int> get() {
-			while (true) {
-				int c = getWithLookahead();	// int so EOF will fit
+	private:
+		StripStats* stats;
+	};
 
-				if (backslash) {
-					backslash = false;
+	// Builds an OffsetMap from what a BasicStripper reads and writes. Each step, or ordinary run, reads some input bytes
+	// and appends some output bytes; the two counts and the state the step began in are enough to tell which bytes were
+	// kept, dropped or replaced (see closeStep()). Output is counted by wrapping the sink in a CountedSink.
+	class OffsetMapBuilder {
+	public:
+		OffsetMapBuilder(OffsetMap& map, const uint64_t& nOutput) : map(&map), nOutput(&nOutput) {}
 
-					if (c == '\n') {
-						++nBackslashNewlinePairs;
-					} else {
-						pushBack(c);
-						auto retVal = make_pair(nBackslashNewlinePairs, static_cast<int>('\\'));
-						nBackslashNewlinePairs = 0;
-						return retVal;
+		void startStep(State s, uint64_t n) {
+			closeStep();
+			stepState = s;
+			stepInput = n;
+			stepOutputStart = *nOutput;
+		}
+
+		// The step just started read the '*' or '/' after a '/': the comment began at that '/', which the previous step
+		// read and held back.
+		void startComment() {
+			commentStart = map->inputSize() - 1;
+		}
+
+		void finish() {
+			closeStep();
+		}
+
+	private:
+		void closeStep() {
+			uint64_t n = stepInput;
+			uint64_t m = *nOutput - stepOutputStart;
+			stepInput = 0;
+			stepOutputStart = *nOutput;
+
+			if (stepState == State::ASTERISK_IN_MULTILINE_COMMENT && m == 1) {	// The space replacing "/*...*/"
+				uint64_t end = map->inputSize() + n;
+				map->retract(map->inputSize() - commentStart);
+				map->append(OffsetMap::Kind::REPLACED, end - commentStart);
+			} else if (m == n) {
+				map->append(OffsetMap::Kind::KEPT, n);
+			} else if (m == 0) {
+				map->append(OffsetMap::Kind::DROPPED, n);
+			} else if (m == n + 1) {	// A '/' held back in SLASH didn't begin a comment, or a CR before a comment's LF
+				map->retract(1);
+				map->append(OffsetMap::Kind::KEPT, n + 1);
+			} else if (stepState == State::IN_SINGLE_LINE_COMMENT ||
+				stepState == State::CARRIAGE_RETURN_IN_SINGLE_LINE_COMMENT) {	// Only the newline ending the comment is kept
+				map->append(OffsetMap::Kind::DROPPED, n - 1);
+				map->append(OffsetMap::Kind::KEPT, 1);
+			} else {	// A '/' that may begin a comment is held back, after the pairs before it
+				map->append(OffsetMap::Kind::KEPT, m);
+				map->append(OffsetMap::Kind::DROPPED, n - m);
+			}
+		}
+
+		OffsetMap* map;
+		const uint64_t* nOutput;
+		State stepState = State::NORMAL;
+		uint64_t stepInput = 0;
+		uint64_t stepOutputStart = 0;
+		uint64_t commentStart = 0;
+	};
+
+	class MappingStats {
+	public:
+		explicit MappingStats(OffsetMapBuilder& builder) : builder(&builder) {}
+		void countBytes(State s, uint64_t n) { builder->startStep(s, n); }
+		void countPairs(unsigned) {}
+		void countComment() { builder->startComment(); }
+		void commentText(const BackslashNewlines&, const char*, size_t) {}
+		void commentEnded() {}
+
+	private:
+		OffsetMapBuilder* builder;
+	};
+
+	template <typename Sink>
+	struct CountedSink {
+		Sink& sink;
+		uint64_t n = 0;
+		void push_back(char c) { sink.push_back(c); ++n; }
+		void append(const char* p, size_t k) { sink.append(p, k); n += k; }
+	};
+
+	// How much has been output, and where its last line starts.
+	struct OutputLines {
+		uint64_t size = 0;
+		uint64_t nNewlines = 0;
+		uint64_t lineStart = 0;		// Output offset just after the last newline
+	};
+
+	template <typename Sink>
+	struct LineCountedSink {
+		Sink& sink;
+		OutputLines lines{};
+
+		void push_back(char c) {
+			sink.push_back(c);
+			++lines.size;
+			if (c == '\n') {
+				++lines.nNewlines;
+				lines.lineStart = lines.size;
+			}
+		}
+
+		void append(const char* p, size_t k) {
+			sink.append(p, k);
+			if (size_t nNewlines = countByte(p, p + k, '\n')) {
+				lines.nNewlines += nNewlines;
+				lines.lineStart = lines.size + string_view(p, k).rfind('\n') + 1;
+			}
+			lines.size += k;
+		}
+	};
+
+	// Passes the comments a BasicStripper drops on to a CommentSink, with where each began. Every newline outside a
+	// comment is output, so a comment's line is 1 plus the newlines output and dropped before it. Its column needs the
+	// input offset of the last of those. A comment's text is a contiguous run of input, so that is easy for newlines in
+	// comments. As for output, after each step it ends with what the step read -- unless the step held back a '/' in
+	// SLASH, or dropped a comment, which outputs no newline. So an output newline's input offset is known as soon as
+	// the next step starts, which is before any comment it could precede.
+	class CommentExtractor {
+	public:
+		CommentExtractor(CommentSink& comments, const OutputLines& output) : comments(&comments), output(&output) {}
+
+		void startStep(State s, uint64_t n) {
+			if (output->nNewlines != nOutputNewlines) {
+				nOutputNewlines = output->nNewlines;
+				lineStart = nInput - (s == State::SLASH) - (output->size - output->lineStart);
+			}
+
+			stepStart = nInput;
+			nInput += n;
+		}
+
+		// The step just started read the '*' or '/' after a '/': the comment began at that '/', which the previous step
+		// read and held back.
+		void beginComment() {
+			commentStart = stepStart - 1;
+			nText = 0;
+			comments->beginComment(SourceLocation{ commentStart, 1 + nOutputNewlines + nCommentNewlines,
+				commentStart - lineStart + 1 });
+		}
+
+		void text(const BackslashNewlines& pairs, const char* p, size_t n) {
+			putOnlyBackslashNewlinePairs(*this, pairs);
+			if (n != 0) {
+				append(p, n);
+			}
+		}
+
+		void endComment() {
+			comments->endComment();
+		}
+
+		// For putOnlyBackslashNewlinePairs()
+		void append(const char* p, size_t n) {
+			comments->append(p, n);
+			if (size_t nNewlines = countByte(p, p + n, '\n')) {
+				nCommentNewlines += nNewlines;
+				lineStart = commentStart + nText + string_view(p, n).rfind('\n') + 1;
+			}
+			nText += n;
+		}
+
+	private:
+		CommentSink* comments;
+		const OutputLines* output;
+		uint64_t nInput = 0;
+		uint64_t stepStart = 0;
+		uint64_t nOutputNewlines = 0;
+		uint64_t nCommentNewlines = 0;
+		uint64_t lineStart = 0;		// Input offset just after the last newline seen
+		uint64_t commentStart = 0;
+		uint64_t nText = 0;			// Bytes of the current comment's text so far
+	};
+
+	// Extracts comments, and counts as Counting (NoStats or CountingStats) does.
+	template <typename Counting>
+	class ExtractingStats {
+	public:
+		ExtractingStats(CommentExtractor& extractor, Counting counting) : extractor(&extractor), counting(counting) {}
+		void countBytes(State s, uint64_t n) { extractor->startStep(s, n); counting.countBytes(s, n); }
+		void countPairs(unsigned n) { counting.countPairs(n); }
+		void countComment() { extractor->beginComment(); counting.countComment(); }
+		void commentText(const BackslashNewlines& pairs, const char* p, size_t n) { extractor->text(pairs, p, n); }
+		void commentEnded() { extractor->endComment(); }
+
+	private:
+		CommentExtractor* extractor;
+		Counting counting;
+	};
+
+	// Appends the line break of each pair, preceded by a space in place of its backslash if spaced.
+	template <typename Out>
+	void putPairLineBreaks(Out& out, const BackslashNewlines& pairs, bool spaced) {
+		pairs.forEach([&](bool isCrlf) {
+			if (spaced) {
+				out.push_back(' ');
+			}
+
+			if (isCrlf) {
+				out.push_back('\r');
+			}
+			out.push_back('\n');
+		});
+	}
+
+	// Replaces each comment with the line breaks (CRs and LFs) in it, so that every line of the output is the same line
+	// of the input.
+	struct PreserveLines {
+		template <typename Out>
+		void replace(const BackslashNewlines& pairs, const char* p, size_t n, Out& out) {
+			putPairLineBreaks(out, pairs, false);
+			for (const char* end = p + n; p != end; ++p) {
+				if (*p == '\n' || *p == '\r') {
+					out.push_back(*p);
+				}
+			}
+		}
+
+		void commentEnded() {}
+		bool spaceAfterComment() const { return true; }
+		bool operator==(const PreserveLines&) const { return true; }
+	};
+
+	// Replaces each byte of each comment with a space, except for tabs and line breaks, so that every byte outside
+	// comments keeps its line and column. The spaces already separate the tokens either side of a multiline comment.
+	struct PreserveColumns {
+		template <typename Out>
+		void replace(const BackslashNewlines& pairs, const char* p, size_t n, Out& out) {
+			putPairLineBreaks(out, pairs, true);
+			for (const char* end = p + n; p != end; ++p) {
+				out.push_back(*p == '\t' || *p == '\n' || *p == '\r' ? *p : ' ');
+			}
+		}
+
+		void commentEnded() {}
+		bool spaceAfterComment() const { return false; }
+		bool operator==(const PreserveColumns&) const { return true; }
+	};
+
+	// Keeps doc comments -- those beginning "///", or "/**" but not "/**/" -- exactly as they were, and drops the rest.
+	// Which a comment is isn't known until its third byte, or its fourth after "/**", so the bytes before that, and the
+	// pairs before each of them, are held back until it is.
+	class KeepDocComments {
+	public:
+		template <typename Out>
+		void replace(const BackslashNewlines& pairs, const char* p, size_t n, Out& out) {
+			if (kind == Kind::UNDECIDED) {
+				pairs.forEach([&](bool isCrlf) { pendingPairs.add(isCrlf); });
+
+				for (; n != 0 && kind == Kind::UNDECIDED; ++p, --n) {
+					heldPairs[nHeld] = pendingPairs;
+					pendingPairs = BackslashNewlines();
+					held[nHeld++] = *p;
+					kind = decide();
+				}
+
+				if (kind == Kind::KEPT) {
+					for (unsigned i = 0; i < nHeld; ++i) {
+						putOnlyBackslashNewlinePairs(out, heldPairs[i]);
+						out.push_back(held[i]);
 					}
+					out.append(p, n);
+				}
+			} else if (kind == Kind::KEPT) {
+				putOnlyBackslashNewlinePairs(out, pairs);
+				out.append(p, n);
+			}
+		}
+
+		void commentEnded() {
+			*this = KeepDocComments();
+		}
+
+		bool spaceAfterComment() const { return kind != Kind::KEPT; }
+
+		bool operator==(const KeepDocComments& rhs) const {
+			return kind == rhs.kind && nHeld == rhs.nHeld && equal(held, held + nHeld, rhs.held) &&
+				equal(heldPairs, heldPairs + nHeld, rhs.heldPairs) && pendingPairs == rhs.pendingPairs;
+		}
+
+	private:
+		enum class Kind : unsigned char {
+			UNDECIDED,
+			KEPT,
+			DROPPED
+		};
+
+		// held[0] is the first '/', and held[1] the '/' or '*' after it
+		Kind decide() const {
+			if (nHeld == 3) {
+				if (held[1] == '/') {
+					return held[2] == '/' ? Kind::KEPT : Kind::DROPPED;
+				}
+
+				return held[2] == '*' ? Kind::UNDECIDED : Kind::DROPPED;
+			}
+
+			return nHeld == 4 ? (held[3] == '/' ? Kind::DROPPED : Kind::KEPT) : Kind::UNDECIDED;
+		}
+
+		Kind kind = Kind::UNDECIDED;
+		unsigned char nHeld = 0;
+		char held[4] = {};
+		BackslashNewlines heldPairs[4];
+		BackslashNewlines pendingPairs;	// Read since the last byte held
+	};
+
+	namespace {
+		// Calls f with the options policy for mode, so that each mode gets its own instantiation of the loop f runs.
+		template <typename F>
+		void withOptions(StripMode mode, F&& f) {
+			switch (mode) {
+			case StripMode::DROP_COMMENTS: f(DropComments()); break;
+			case StripMode::PRESERVE_LINES: f(PreserveLines()); break;
+			case StripMode::PRESERVE_COLUMNS: f(PreserveColumns()); break;
+			case StripMode::KEEP_DOC_COMMENTS: f(KeepDocComments()); break;
+			}
+		}
+	}
+
+
+	void stripComments(string_view in, string& out) {
+		Stripper stripper;
+		stripper.feed(in.data(), in.data() + in.size(), out);
+		stripper.finish(out);
+	}
+
+	void stripComments(string_view in, string& out, StripStats& stats) {
+		auto start = chrono::steady_clock::now();
+		size_t oldOutSize = out.size();
+		BasicStripper<CountingStats> stripper(pack(State::NORMAL, false), CountingStats(stats));
+		stripper.feed(in.data(), in.data() + in.size(), out);
+		stripper.finish(out);
+
+		stats.inputBytes += in.size();
+		stats.outputBytes += out.size() - oldOutSize;
+		stats.elapsedSeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
+	void stripComments(string_view in, string& out, CommentSink& comments) {
+		LineCountedSink<string> counted{ out };
+		CommentExtractor extractor(comments, counted.lines);
+		BasicStripper<ExtractingStats<NoStats>> stripper(pack(State::NORMAL, false), { extractor, NoStats() });
+		stripper.feed(in.data(), in.data() + in.size(), counted);
+		stripper.finish(counted);
+	}
+
+	void stripComments(string_view in, string& out, CommentSink& comments, StripStats& stats) {
+		auto start = chrono::steady_clock::now();
+		size_t oldOutSize = out.size();
+		LineCountedSink<string> counted{ out };
+		CommentExtractor extractor(comments, counted.lines);
+		BasicStripper<ExtractingStats<CountingStats>> stripper(pack(State::NORMAL, false), { extractor, CountingStats(stats) });
+		stripper.feed(in.data(), in.data() + in.size(), counted);
+		stripper.finish(counted);
+
+		stats.inputBytes += in.size();
+		stats.outputBytes += out.size() - oldOutSize;
+		stats.elapsedSeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
+	// Minifies what a BasicStripper outputs as it arrives, asking the stripper's state whether each piece is code or the
+	// contents of a literal, which are passed through untouched; so nothing is lexed twice. In code, line continuations
+	// are spliced away, as the compiler would, and each run of whitespace becomes a single space where the bytes either
+	// side might otherwise run together into different tokens, or nothing where they can't. Newlines are kept only
+	// around preprocessor directives, which must still each have a line to themselves; within one, no whitespace run is
+	// dropped entirely, as e.g. "#define f (x)" differs from "#define f(x)". A whitespace run is held back until the
+	// byte after it says what it should become.
+	template <typename Sink, typename Stripper>
+	class MinifyingSink {
+	public:
+		MinifyingSink(Sink& sink, const Stripper& stripper) : sink(sink), stripper(stripper) {}
+
+		void push_back(char c) {
+			append(&c, 1);
+		}
+
+		void append(const char* p, size_t n) {
+			State s = stripper.currentState();
+			bool literal = (s == State::IN_STRING || s == State::IN_CHAR || s >= State::RAW_STRING_DELIMITER);
+
+			// Each backslash-newline pair arrives on its own, and nothing else looks like one. It arrives in the state
+			// it was read in, except that those between a '/' and a quote arrive in the state of the literal it opens.
+			if ((n == 2 && p[0] == '\\' && p[1] == '\n') || (n == 3 && p[0] == '\\' && p[1] == '\r' && p[2] == '\n')) {
+				if (literal && inLiteral) {
+					put(p, n);
+				}
+				return;
+			}
+
+			if (literal) {
+				startToken(*p, false);
+				put(p, n);
+				inLiteral = true;
+				return;
+			}
+
+			// A newline right after a literal's contents ends it unterminated, so stays, lest the literal run on
+			if (inLiteral && n != 0 && *p == '\n') {
+				put(p, 1);
+				lineStarted = false;
+				directive = false;
+				++p;
+				--n;
+			}
+
+			inLiteral = false;
+			const char* end = p + n;
+			while (p != end) {
+				if (*p == ' ' || *p == '\t' || *p == '\r') {
+					spaceHeld = true;
+					++p;
+				} else if (*p == '\n') {
+					endLine();
+					++p;
 				} else {
-					if (c == '\\') {
-						backslash = true;
-					} else {
-						auto retVal = make_pair(nBackslashNewlinePairs, c);
-						nBackslashNewlinePairs = 0;
-						return retVal;
+					if (spaceHeld || !lineStarted) {
+						startToken(*p, true);
+					}
+
+					// Only whitespace calls for a decision, so the run of bytes up to it is output as is
+					const char* q = p + 1;
+					while (q != end && !isSpace(*q)) {
+						++q;
 					}
+
+					put(p, q - p);
+					p = q;
 				}
 			}
 		}
 
-		bool eof() {
-			return is.eof() && !lookedAhead;
+		// Ends the output with a newline if the input's last code ended with one, and passes everything on to sink.
+		void finish() {
+			if (anyOutput() && !lineStarted && last != '\n') {
+				put("\n", 1);
+			}
+
+			flushBuffer();
 		}
 
 	private:
-		int getWithLookahead() {
-			if (lookedAhead) {
-				lookedAhead = false;
-				return lookaheadBuf;
-			} else {
-				return is.get();
+		static bool isSpace(char c) {
+			return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+		}
+
+		static bool isWord(char c) {
+			unsigned char u = static_cast<unsigned char>(c);
+			return (u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z') || (u >= '0' && u <= '9') || u == '_' || u == '$' ||
+				u >= 0x80;
+		}
+
+		// Could l and r, with nothing between them, be read differently than with a space between them? Errs on the
+		// side of yes.
+		static bool needsSpace(char l, char r) {
+			auto separator = [](char c) { return c == '(' || c == ')' || c == '[' || c == ']' || c == '{' || c == '}' || c == ',' || c == ';'; };
+			auto quote = [](char c) { return c == '"' || c == '\''; };
+			if (separator(l) || separator(r) || (quote(l) && quote(r))) {
+				return false;
+			}
+
+			bool wordLike = isWord(l) || quote(l);			// Literal prefixes and suffixes join words to quotes
+			bool nextWordLike = isWord(r) || quote(r);
+			if (wordLike == nextWordLike) {
+				return true;								// Two words, or two punctuators that may form a longer one
 			}
+
+			return (isWord(l) && r == '.') || (l == '.' && r >= '0' && r <= '9') ||	// Numbers: 1 .5, . 5, 1e + 5
+				((l == 'e' || l == 'E' || l == 'p' || l == 'P') && (r == '+' || r == '-'));
 		}
 
-		void pushBack(int c) {
-			lookedAhead = true;
-			lookaheadBuf = c;
+		bool anyOutput() const {
+			return nBuffered != 0 || flushed;
 		}
 
-		istream& is;
-		bool backslash;	// Did we just read a backslash?
-		unsigned nBackslashNewlinePairs;
-		int lookaheadBuf;
-		bool lookedAhead;	// Did we read a character too early?
-	};
+		// Outputs whatever the whitespace held back before r should become.
+		void startToken(char r, bool code) {
+			if (!lineStarted) {
+				lineStarted = true;
+				if (code && r == '#') {
+					directive = true;
+					newlineHeld = true;
+				}
+			}
+
+			if (anyOutput() && last != '\n') {
+				if (newlineHeld) {
+					put("\n", 1);
+				} else if (spaceHeld && (directive || needsSpace(last, r))) {
+					put(" ", 1);
+				}
+			}
 
-	void putOnlyBackslashNewlinePairs(ostream& os, unsigned nBackslashNewlinePairs) {
-		for (unsigned i = 0; i < nBackslashNewlinePairs; ++i) {
-			os.put('\\');
-			os.put('\n');
+			spaceHeld = false;
+			newlineHeld = false;
+		}
+
+		void endLine() {
+			if (directive) {
+				directive = false;
+				newlineHeld = true;
+			}
+
+			lineStarted = false;
+			spaceHeld = true;
+		}
+
+		// Tokens are mostly a few bytes long, so are gathered into a buffer rather than appended to sink one by one
+		void put(const char* p, size_t n) {
+			if (n > sizeof buffer - nBuffered) {
+				flushBuffer();
+				if (n > sizeof buffer) {
+					sink.append(p, n);
+					flushed = true;
+					last = p[n - 1];
+					return;
+				}
+			}
+
+			copy(p, p + n, buffer + nBuffered);
+			nBuffered += n;
+			last = p[n - 1];
+		}
+
+		void flushBuffer() {
+			if (nBuffered != 0) {
+				sink.append(buffer, nBuffered);
+				flushed = true;
+				nBuffered = 0;
+			}
 		}
+
+		Sink& sink;
+		const Stripper& stripper;
+		char buffer[4096];
+		size_t nBuffered = 0;
+		bool flushed = false;		// Has anything been passed on to sink?
+		char last = 0;				// The last byte output
+		bool lineStarted = false;	// Has anything been output since the last newline read?
+		bool directive = false;		// Is the line being read a preprocessor directive?
+		bool spaceHeld = false;
+		bool newlineHeld = false;	// Held back whitespace must be a newline, as a directive ended or begins
+		bool inLiteral = false;		// Was the last byte output inside a literal?
+	};
+
+	void stripComments(string_view in, string& out, StripMode mode) {
+		withOptions(mode, [&](auto options) {
+			BasicStripper<NoStats, decltype(options)> stripper(pack(State::NORMAL, false), NoStats(), options);
+			stripper.feed(in.data(), in.data() + in.size(), out);
+			stripper.finish(out);
+		});
 	}
 
-	void put(ostream& os, pair<unsigned, int> p) {
-		putOnlyBackslashNewlinePairs(os, p.first);
-		os.put(p.second);
+	void stripAndMinify(string_view in, string& out) {
+		Stripper stripper;
+		MinifyingSink<string, Stripper> minified(out, stripper);
+		stripper.feed(in.data(), in.data() + in.size(), minified);
+		stripper.finish(minified);
+		minified.finish();
 	}
 
-	void stripComments(istream& is, ostream& os) {
-		enum class State {
-			NORMAL,
-			IN_STRING,
-			IN_CHAR,
-			SLASH,
-			ASTERISK_IN_MULTILINE_COMMENT,
-			IN_SINGLE_LINE_COMMENT,
-			IN_MULTILINE_COMMENT
+	void stripComments(string_view in, string& out, OffsetMap& map) {
+		map = OffsetMap();
+		CountedSink<string> counted{ out };
+		OffsetMapBuilder builder(map, counted.n);
+		BasicStripper<MappingStats> stripper(pack(State::NORMAL, false), MappingStats(builder));
+		stripper.feed(in.data(), in.data() + in.size(), counted);
+		stripper.finish(counted);
+		builder.finish();
+	}
+
+	// Parallel stripping of a single buffer. The buffer is cut into chunks just after newlines that do not end
+	// backslash-newline pairs (with or without a CR), where BackslashNewlineReader holds nothing back, so the only unknown at the start of each
+	// chunk is the state machine's state -- and only the few states that a newline can lead to are possible. Each chunk
+	// is speculatively stripped from all of them at once. Runs started from different states nearly always converge
+	// within a line or two (e.g., at the first newline outside a multiline comment), after which a single run finishes
+	// the chunk. Once all chunks are done, the true entry state of each is known in order, and the matching output is
+	// stitched together. A chunk whose runs fail to converge within a budget is stripped again sequentially, so the
+	// output is always byte-identical to that of the sequential path. A chunk that starts inside a raw string matches
+	// none of the entry states (they don't know its delimiter), so is stripped sequentially too.
+	namespace {
+		vector<PackedState> statesAfterNewline() {
+			vector<PackedState> states;
+			for (size_t s = 0; s < static_cast<size_t>(State::RAW_STRING_DELIMITER); ++s) {
+				for (bool b : { false, true }) {
+					PackedState next = transitionTable[pack(static_cast<State>(s), b) + static_cast<size_t>(ByteClass::NEWLINE)].next;
+					if (find(states.begin(), states.end(), next) == states.end()) {
+						states.push_back(next);
+					}
+				}
+			}
+
+			return states;
+		}
+
+		struct Speculation {
+			vector<PackedState> entries;	// Candidate entry states
+			vector<string> prefixOutputs;	// Output for each entry state, up to the point where all runs converged
+			string sharedOutput;			// Output from the convergence point to the end of the chunk
+			vector<Stripper> exits;			// State at the end of the chunk, for each entry state
+			bool gaveUp = false;			// Runs didn't converge in time; strip the chunk sequentially instead
 		};
 
-		State state = State::NORMAL;
-		bool backslashSeen = false;
-		BackslashNewlineReader reader{is};
+		Speculation speculate(const char* begin, const char* end, vector<PackedState> entries) {
+			const size_t blockSize = 4 * 1024;
+			const size_t convergenceBudget = 1024 * 1024;	// Bounds memory spent on per-entry-state output
 
-		while (true) {
-			auto p = reader.get();
-			auto c = p.second;	// Convenience
-			if (reader.eof()) {
-				putOnlyBackslashNewlinePairs(os, p.first);
+			Speculation spec;
+			spec.entries = move(entries);
+			spec.prefixOutputs.resize(spec.entries.size());
+			vector<Stripper> runs;
+			for (PackedState entry : spec.entries) {
+				runs.emplace_back(entry);
+			}
 
-				if (state == State::SLASH) {
-					os.put('/');
+			const char* p = begin;
+			while (true) {
+				bool converged = all_of(runs.begin(), runs.end(), [&](const Stripper& r) { return r == runs[0]; });
+				if (converged) {
+					runs[0].feed(p, end, spec.sharedOutput);
+					spec.exits.assign(runs.size(), runs[0]);
+					return spec;
 				}
 
-				break;
-			}
+				if (p == end) {
+					spec.exits = runs;
+					return spec;
+				}
 
-			if (is.bad()) {
-				throw runtime_error{"An unexpected error occurred while stripping comments"};
+				if (static_cast<size_t>(p - begin) >= convergenceBudget) {
+					spec.gaveUp = true;
+					return spec;
+				}
+
+				const char* q = p + min(blockSize, static_cast<size_t>(end - p));
+				for (size_t i = 0; i < runs.size(); ++i) {
+					runs[i].feed(p, q, spec.prefixOutputs[i]);
+				}
+
+				p = q;
 			}
+		}
 
-			switch (state) {
-			case State::NORMAL:
-				switch (c) {
-				case '"':
-					state = State::IN_STRING;
-					put(os, p);
-					backslashSeen = false;
-					break;
+		// Returns chunk boundaries: 0, then offsets just after suitable newlines near multiples of in.size() / nChunks, then in.size().
+		vector<size_t> chooseChunkBoundaries(string_view in, size_t nChunks) {
+			auto endsPair = [&](size_t i) {	// Does the newline at i end a backslash-newline pair?
+				return (i >= 1 && in[i - 1] == '\\') || (i >= 2 && in[i - 1] == '\r' && in[i - 2] == '\\');
+			};
 
-				case '\'':
-					state = State::IN_CHAR;
-					put(os, p);
-					backslashSeen = false;
-					break;
+			vector<size_t> boundaries{ 0 };
+			for (size_t k = 1; k < nChunks; ++k) {
+				size_t i = max(in.size() / nChunks * k, boundaries.back());
+				while (i < in.size() && !(in[i] == '\n' && !endsPair(i))) {
+					++i;
+				}
 
-				case '\\':
-					put(os, p);
-					backslashSeen = !backslashSeen;
+				if (i >= in.size()) {
 					break;
+				}
 
-				case '/':
-					state = State::SLASH;
-					putOnlyBackslashNewlinePairs(os, p.first);
-					backslashSeen = false;
-					break;
+				boundaries.push_back(i + 1);
+			}
 
-				default:
-					put(os, p);
-					backslashSeen = false;
-					break;
+			boundaries.push_back(in.size());
+			return boundaries;
+		}
+	}
+
+	void stripCommentsParallel(string_view in, string& out, unsigned nThreads) {
+		const size_t minChunkSize = 1024 * 1024;	// Smaller chunks aren't worth a thread
+		const size_t chunksPerThread = 4;			// Some slack to even out the load
+
+		size_t nChunks = min(static_cast<size_t>(max(nThreads, 1u)) * chunksPerThread, in.size() / minChunkSize);
+		if (nThreads <= 1 || nChunks <= 1) {
+			stripComments(in, out);
+			return;
+		}
+
+		vector<size_t> boundaries = chooseChunkBoundaries(in, nChunks);
+		nChunks = boundaries.size() - 1;
+		const vector<PackedState> candidates = statesAfterNewline();
+
+		vector<Speculation> specs(nChunks);
+		atomic<size_t> nextChunk{ 0 };
+		auto worker = [&] {
+			for (size_t k; (k = nextChunk++) < nChunks; ) {
+				vector<PackedState> entries = (k == 0 ? vector<PackedState>{ pack(State::NORMAL, false) } : candidates);
+				specs[k] = speculate(in.data() + boundaries[k], in.data() + boundaries[k + 1], move(entries));
+			}
+		};
+
+		vector<thread> threads;
+		for (unsigned t = 1; t < min(static_cast<size_t>(nThreads), nChunks); ++t) {
+			threads.emplace_back(worker);
+		}
+		worker();
+		for (auto& t : threads) {
+			t.join();
+		}
+
+		Stripper stripper;
+		for (size_t k = 0; k < nChunks; ++k) {
+			Speculation& spec = specs[k];
+			size_t i = 0;
+			while (i < spec.entries.size() && !(Stripper(spec.entries[i]) == stripper)) {
+				++i;
+			}
+
+			if (spec.gaveUp || i == spec.entries.size()) {
+				stripper.feed(in.data() + boundaries[k], in.data() + boundaries[k + 1], out);
+			} else {
+				out += spec.prefixOutputs[i];
+				out += spec.sharedOutput;
+				stripper = spec.exits[i];
+			}
+
+			spec = Speculation();	// Free memory as we go
+		}
+
+		stripper.finish(out);
+	}
+
+	namespace {
+		// Reads is in large blocks, so that it is not touched once per character. Returns the number of bytes read.
+		template <typename Sink, typename Stripper>
+		uint64_t feedStream(istream& is, Stripper& stripper, Sink& sink) {
+			const size_t blockSize = 64 * 1024;
+			vector<char> inBuf(blockSize);
+			uint64_t nRead = 0;
+
+			while (is) {
+				is.read(inBuf.data(), inBuf.size());
+				if (is.bad()) {
+					throw runtime_error{"An unexpected error occurred while stripping comments"};
 				}
-				break;
-
-			case State::IN_STRING:
-				switch (c) {
-				case '"': // Fall through
-				case '\n': // Newline before end of string: Syntax error
-					if (!backslashSeen) {
-						state = State::NORMAL;
-					}
-					put(os, p);
-					backslashSeen = false;
-					break;
 
-				case '\\':
-					put(os, p);
-					backslashSeen = !backslashSeen;
-					break;
+				nRead += is.gcount();
+				stripper.feed(inBuf.data(), inBuf.data() + is.gcount(), sink);
+			}
 
-				default:
-					put(os, p);
-					backslashSeen = false;
-					break;
+			stripper.finish(sink);
+			return nRead;
+		}
+
+		template <typename Sink, typename Stats, typename Options = DropComments>
+		uint64_t stripStream(istream& is, Sink& sink, Stats stats, Options options = Options()) {
+			BasicStripper<Stats, Options> stripper(pack(State::NORMAL, false), stats, options);
+			return feedStream(is, stripper, sink);
+		}
+
+		void stripStreamWithStats(istream& is, OutputSink& sink, StripStats& stats) {
+			auto start = chrono::steady_clock::now();
+			uint64_t oldSinkSize = sink.size();
+			stats.inputBytes += stripStream(is, sink, CountingStats(stats));
+			sink.flush();
+			stats.outputBytes += sink.size() - oldSinkSize;
+			stats.elapsedSeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		}
+	}
+
+	void stripComments(istream& is, ostream& os) {
+		OstreamOutputSink sink(os);
+		stripStream(is, sink, NoStats());
+		sink.flush();
+	}
+
+	void stripComments(istream& is, OutputSink& sink) {
+		stripStream(is, sink, NoStats());
+		sink.flush();
+	}
+
+	void stripComments(istream& is, OutputSink& sink, StripMode mode) {
+		withOptions(mode, [&](auto options) { stripStream(is, sink, NoStats(), options); });
+		sink.flush();
+	}
+
+	void stripAndMinify(istream& is, OutputSink& sink) {
+		Stripper stripper;
+		MinifyingSink<OutputSink, Stripper> minified(sink, stripper);
+		feedStream(is, stripper, minified);
+		minified.finish();
+		sink.flush();
+	}
+
+	void stripComments(istream& is, OutputSink& sink, OffsetMap& map) {
+		map = OffsetMap();
+		CountedSink<OutputSink> counted{ sink };
+		OffsetMapBuilder builder(map, counted.n);
+		stripStream(is, counted, MappingStats(builder));
+		builder.finish();
+		sink.flush();
+	}
+
+	void stripComments(istream& is, OutputSink& sink, CommentSink& comments) {
+		LineCountedSink<OutputSink> counted{ sink };
+		CommentExtractor extractor(comments, counted.lines);
+		stripStream(is, counted, ExtractingStats<NoStats>(extractor, NoStats()));
+		sink.flush();
+	}
+
+	void stripComments(istream& is, OutputSink& sink, CommentSink& comments, StripStats& stats) {
+		auto start = chrono::steady_clock::now();
+		uint64_t oldSinkSize = sink.size();
+		LineCountedSink<OutputSink> counted{ sink };
+		CommentExtractor extractor(comments, counted.lines);
+		stats.inputBytes += stripStream(is, counted, ExtractingStats<CountingStats>(extractor, CountingStats(stats)));
+		sink.flush();
+		stats.outputBytes += sink.size() - oldSinkSize;
+		stats.elapsedSeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
+	void stripComments(istream& is, ostream& os, StripStats& stats) {
+		OstreamOutputSink sink(os);
+		stripStreamWithStats(is, sink, stats);
+	}
+
+	void stripComments(istream& is, OutputSink& sink, StripStats& stats) {
+		stripStreamWithStats(is, sink, stats);
+	}
+
+	namespace {
+		// Output arrives as short runs and single bytes, which XXH64 is much slower at taking than whole blocks.
+		class HashingSink : public OutputSink {
+		public:
+			HashingSink() : OutputSink(64 * 1024) {}
+
+			uint64_t digest() {
+				flush();
+				return hash.digest();
+			}
+
+		protected:
+			void write(const char* p, size_t n) override {
+				hash.append(p, n);
+			}
+
+		private:
+			Xxh64 hash;
+		};
+	}
+
+	uint64_t fingerprint(string_view in) {
+		HashingSink sink;
+		CommentStripper stripper;
+		stripper.feed(in, sink);
+		stripper.finish(sink);
+		return sink.digest();
+	}
+
+	uint64_t fingerprint(istream& is) {
+		HashingSink sink;
+		stripStream(is, sink, NoStats());
+		return sink.digest();
+	}
+
+	// Finding the first comment. Blocks are stripped into a sink that discards everything, with a stats policy that
+	// raises a flag when a comment begins, checked after each block. The block it begins in is then replayed a byte at a
+	// time to find the byte that started it. The comment's first '/' may be in the block before -- it can be separated
+	// from the '/' or '*' that follows by any number of backslash-newline pairs -- so the previous block is kept too.
+	namespace {
+		const size_t queryBlockSize = 64 * 1024;
+
+		struct DiscardingSink {
+			void push_back(char) {}
+			void append(const char*, size_t) {}
+		};
+
+		struct CommentFlag {
+			bool* seen;
+			void countBytes(State, uint64_t) {}
+			void countPairs(unsigned) {}
+			void countComment() { *seen = true; }
+			void commentText(const BackslashNewlines&, const char*, size_t) {}
+			void commentEnded() {}
+		};
+
+		// nextBlock() returns the next block of input, or an empty one at the end. Each block must stay valid until
+		// the one after it has been returned.
+		template <typename NextBlock>
+		optional<SourceLocation> findFirstCommentInBlocks(NextBlock&& nextBlock) {
+			bool seen = false;
+			DiscardingSink sink;
+			BasicStripper<CommentFlag> stripper(pack(State::NORMAL, false), CommentFlag{ &seen });
+			BasicStripper<CommentFlag> beforePrevious = stripper;
+			BasicStripper<CommentFlag> beforeCurrent = stripper;
+			string_view previous;
+			string_view current;
+			uint64_t previousStart = 0;
+			uint64_t linesBeforePrevious = 0;
+			uint64_t lineStartBeforePrevious = 0;
+			for (;;) {
+				linesBeforePrevious += countByte(previous.data(), previous.data() + previous.size(), '\n');
+				size_t lastNewline = previous.rfind('\n');
+				if (lastNewline != string_view::npos) {
+					lineStartBeforePrevious = previousStart + lastNewline + 1;
 				}
-				break;
-
-			case State::IN_CHAR:
-				switch (c) {
-				case '\'': // Fall through
-				case '\n': // Newline before end of character literal: Syntax error
-					if (!backslashSeen) {
-						state = State::NORMAL;
-					}
-					put(os, p);
-					backslashSeen = false;
-					break;
 
-				case '\\':
-					put(os, p);
-					backslashSeen = !backslashSeen;
-					break;
+				previousStart += previous.size();
+				previous = current;
+				beforePrevious = beforeCurrent;
+				current = nextBlock();
+				if (current.empty()) {
+					return nullopt;		// finish() can't start a comment
+				}
 
-				default:
-					put(os, p);
-					backslashSeen = false;
+				beforeCurrent = stripper;
+				stripper.feed(current.data(), current.data() + current.size(), sink);
+				if (seen) {
 					break;
 				}
-				break;
+			}
 
-			case State::SLASH:
-				switch (c) {
-				case '/':
-					state = State::IN_SINGLE_LINE_COMMENT;
+			// The comment starts at the last '/' before the byte that confirmed it
+			auto at = [&](size_t i) { return i < previous.size() ? &previous[i] : &current[i - previous.size()]; };
+			seen = false;
+			size_t start = 0;
+			for (size_t i = 0; ; ++i) {
+				beforePrevious.feed(at(i), at(i) + 1, sink);
+				if (seen) {
 					break;
+				}
 
-				case '*':
-					state = State::IN_MULTILINE_COMMENT;
-					break;
+				if (*at(i) == '/') {
+					start = i;
+				}
+			}
 
-				default:
-					state = State::NORMAL;
-					os.put('/');
-					put(os, p);
-					break;
+			uint64_t line = linesBeforePrevious + 1;
+			uint64_t lineStart = lineStartBeforePrevious;
+			for (size_t i = 0; i < start; ++i) {
+				if (*at(i) == '\n') {
+					++line;
+					lineStart = previousStart + i + 1;
 				}
-				break;
+			}
+
+			return SourceLocation{ previousStart + start, line, previousStart + start - lineStart + 1 };
+		}
+	}
+
+	optional<SourceLocation> findFirstComment(string_view in) {
+		return findFirstCommentInBlocks([&] {
+			string_view block = in.substr(0, queryBlockSize);
+			in.remove_prefix(block.size());
+			return block;
+		});
+	}
+
+	optional<SourceLocation> findFirstComment(istream& is) {
+		vector<char> buffers[2] = { vector<char>(queryBlockSize), vector<char>(queryBlockSize) };
+		size_t nBlocks = 0;
+		return findFirstCommentInBlocks([&] {
+			vector<char>& buffer = buffers[nBlocks++ % 2];
+			is.read(buffer.data(), buffer.size());
+			if (is.bad()) {
+				throw runtime_error{"An unexpected error occurred while reading input"};
+			}
+
+			return string_view(buffer.data(), static_cast<size_t>(is.gcount()));
+		});
+	}
+
+	// Pipelined stripping. A reader thread fills input blocks, this thread strips them into output blocks, and a writer
+	// thread drains those to the sink. Each kind of block circulates between two stages through a pair of SPSC rings --
+	// one carrying full blocks forward, the other returning empty ones -- so there are never more than nBlocks of each,
+	// and a stage that gets ahead simply waits for a block to come back.
+	namespace {
+		const size_t nBlocks = 4;
+		const size_t pipelineBlockSize = 256 * 1024;
+
+		struct Block {
+			string data;
+			bool last = false;	// No more blocks follow
+		};
+
+		using BlockRing = SpscRing<Block*, nBlocks>;
+	}
+
+	void stripCommentsPipelined(istream& is, OutputSink& sink) {
+		vector<Block> inBlocks(nBlocks), outBlocks(nBlocks);
+		BlockRing freeIn, fullIn, freeOut, fullOut;
+		for (size_t i = 0; i < nBlocks; ++i) {
+			inBlocks[i].data.resize(pipelineBlockSize);
+			freeIn.push(&inBlocks[i]);
+			outBlocks[i].data.reserve(pipelineBlockSize + pipelineBlockSize / 2);
+			freeOut.push(&outBlocks[i]);
+		}
 
-			case State::IN_SINGLE_LINE_COMMENT:
-				if (c == '\n') {
-					state = State::NORMAL;
-					os.put('\n');
+		// Errors are carried back to this thread. A stage that fails keeps passing blocks on, marking the end of input
+		// early (reader) or discarding output (writer), so that no other stage waits forever. If writing or stripping
+		// fails, stopping has the reader end the input at its next block rather than read the rest for nothing, and the
+		// writer discard what is still to come. If stripping fails, this thread drains what they pass it until they are
+		// done.
+		exception_ptr readError, writeError, stripError;
+		atomic<bool> stopping{ false };
+
+		thread reader([&] {
+			for (bool last = false; !last; ) {
+				Block* block = freeIn.pop();
+				block->data.resize(pipelineBlockSize);
+				try {
+					if (stopping) {
+						block->data.clear();
+						last = true;
+					} else {
+						is.read(&block->data[0], block->data.size());
+						if (is.bad()) {
+							throw runtime_error{"An unexpected error occurred while stripping comments"};
+						}
+
+						block->data.resize(is.gcount());
+						last = !is;
+					}
+				} catch (...) {
+					readError = current_exception();
+					block->data.clear();
+					last = true;
 				}
-				break;
 
-			case State::IN_MULTILINE_COMMENT:
-				if (c == '*') {
-					state = State::ASTERISK_IN_MULTILINE_COMMENT;
+				block->last = last;
+				fullIn.push(block);
+			}
+		});
+
+		thread writer([&] {
+			for (bool last = false; !last; ) {
+				Block* block = fullOut.pop();
+				if (!writeError && !stopping) {
+					try {
+						sink.append(block->data.data(), block->data.size());
+						if (block->last) {
+							sink.flush();
+						}
+					} catch (...) {
+						writeError = current_exception();
+						stopping = true;
+					}
 				}
-				break;
-				
-			case State::ASTERISK_IN_MULTILINE_COMMENT:
-				switch (c) {
-				case '/':
-					os.put(' ');	// Insert a space to preserve parsing of "abc/*---*/def" as 2 tokens
-					state = State::NORMAL;
-					break;
 
-				case '*': break;	// Stay in ASTERISK_IN_MULTILINE_COMMENT
+				last = block->last;
+				freeOut.push(block);
+			}
+		});
 
-				default:
-					state = State::IN_MULTILINE_COMMENT;
-					break;
+		Stripper stripper;
+		Block* out = freeOut.pop();
+		out->data.clear();
+		Block* in = nullptr;	// Held by this thread
+		bool last = false;
+		try {
+			while (!last) {
+				in = fullIn.pop();
+				stripper.feed(in->data.data(), in->data.data() + in->data.size(), out->data);
+				last = in->last;
+				freeIn.push(exchange(in, nullptr));
+
+				if (last) {
+					stripper.finish(out->data);
 				}
-				break;
+
+				if (last || out->data.size() >= pipelineBlockSize) {
+					out->last = last;
+					fullOut.push(exchange(out, nullptr));
+					if (!last) {
+						out = freeOut.pop();
+						out->data.clear();
+					}
+				}
+			}
+		} catch (...) {
+			stripError = current_exception();
+			stopping = true;
+			if (in) {
+				last = in->last;
+				freeIn.push(in);
+			}
+
+			while (!last) {
+				Block* block = fullIn.pop();
+				last = block->last;
+				freeIn.push(block);
+			}
+
+			if (out) {
+				out->data.clear();
+				out->last = true;
+				fullOut.push(out);
 			}
 		}
+
+		reader.join();
+		writer.join();
+		if (stripError) {
+			rethrow_exception(stripError);
+		}
+
+		if (readError) {
+			rethrow_exception(readError);
+		}
+
+		if (writeError) {
+			rethrow_exception(writeError);
+		}
+	}
+
+	StripStats& StripStats::operator+=(const StripStats& rhs) {
+		for (size_t i = 0; i < nStates; ++i) {
+			bytesInState[i] += rhs.bytesInState[i];
+		}
+
+		commentsRemoved += rhs.commentsRemoved;
+		continuationPairs += rhs.continuationPairs;
+		inputBytes += rhs.inputBytes;
+		outputBytes += rhs.outputBytes;
+		elapsedSeconds += rhs.elapsedSeconds;
+		return *this;
 	}
 }
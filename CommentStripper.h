@@ -1,12 +1,183 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include "OffsetMap.h"
+#include "OutputSink.h"
+#include "StateMachine.h"
+#include "Stripper.h"
 
 namespace commentstripper {
+	/**
+	 * Identifies the stripping rules. Bump it whenever the output for some input changes, so that cached outputs (see
+	 * StripCache) made by older builds are no longer used.
+	 */
+	const unsigned stripperVersion = 5;
+
 	/**
 	 * Writes is to os, stripping all C++ single-line and multiline comments as it goes.
 	 * See bottom of tests.cpp for known limitations.
 	 * Throws a runtime_error on I/O failure.
 	 */
 	void stripComments(std::istream& is, std::ostream& os);
+
+	/**
+	 * As stripComments(is, os), but writes to sink, which is flushed before returning. With an FdOutputSink, output
+	 * bypasses iostreams altogether.
+	 */
+	void stripComments(std::istream& is, OutputSink& sink);
+
+	/**
+	 * As stripComments(is, sink), but reads is and writes sink on two extra threads, so that waiting on slow storage or
+	 * a slow consumer overlaps with stripping. The three stages pass a fixed number of fixed-size blocks around, so
+	 * memory use is that of stripComments() plus those blocks. Output is identical.
+	 */
+	void stripCommentsPipelined(std::istream& is, OutputSink& sink);
+
+	/**
+	 * Appends in to out, stripping all C++ single-line and multiline comments as it goes.
+	 * Produces exactly the same output as the stream-based overload, but runs directly over a contiguous buffer.
+	 */
+	void stripComments(std::string_view in, std::string& out);
+
+	/**
+	 * What stripping leaves in place of each comment.
+	 */
+	enum class StripMode {
+		DROP_COMMENTS,		// Nothing but the newline ending a single-line comment, or a space for a multiline one
+		PRESERVE_LINES,		// The comment's line breaks, so that the output has the input's line numbers
+		PRESERVE_COLUMNS,	// Spaces, but for the comment's tabs and line breaks, so that the output has the input's columns
+		KEEP_DOC_COMMENTS	// The comment itself if it begins "///" or "/**" (but not "/**/"); else as DROP_COMMENTS
+	};
+
+	/**
+	 * As stripComments(is, sink) and stripComments(in, out), but leaving what mode says in place of each comment. Each
+	 * mode is compiled into its own instantiation of the stripping loop, so none of them checks the mode as it goes,
+	 * and DROP_COMMENTS gives exactly the output of the overloads without a mode.
+	 */
+	void stripComments(std::istream& is, OutputSink& sink, StripMode mode);
+	void stripComments(std::string_view in, std::string& out, StripMode mode);
+
+	/**
+	 * As stripComments(is, sink) and stripComments(in, out), but also minifies the code that is left, in the same pass:
+	 * runs of whitespace become a single space, or nothing where no tokens would run together without one; line
+	 * continuations are spliced; and lines are joined, except that each preprocessor directive keeps a line of its own.
+	 * The contents of string, character and raw string literals are never touched.
+	 */
+	void stripAndMinify(std::istream& is, OutputSink& sink);
+	void stripAndMinify(std::string_view in, std::string& out);
+
+	/**
+	 * Strips comments from input that arrives in chunks, e.g. from the network, when there is no istream to hand over.
+	 * Chunks may be split anywhere -- even between the backslash and newline of a line continuation, or the '/' and
+	 * '*' of a comment marker -- with the same result as passing the whole input at once. Nothing is buffered: output
+	 * for each chunk is appended to sink (an OutputSink, a std::string or anything else with push_back() and append()) as soon as it
+	 * is known. The state carried between chunks is a few dozen bytes, plus whatever a run of line continuations after a
+	 * '/' needs to record its line endings (see Stripper.h).
+	 */
+	class CommentStripper {
+	public:
+		template <typename Sink>
+		void feed(std::string_view chunk, Sink& sink) {
+			stripper.feed(chunk.data(), chunk.data() + chunk.size(), sink);
+		}
+
+		/**
+		 * Flushes output held back at the end of input (a trailing '/' or backslash), and resets, so that another
+		 * input can be fed.
+		 */
+		template <typename Sink>
+		void finish(Sink& sink) {
+			stripper.finish(sink);
+		}
+
+	private:
+		Stripper stripper;
+	};
+
+	/**
+	 * The XXH64 hash of what stripComments() would output for the input, computed without storing that output. Inputs
+	 * that differ only in their comments have the same fingerprint, so a build can skip recompiling when it is
+	 * unchanged. The istream overload throws a runtime_error on I/O failure.
+	 */
+	std::uint64_t fingerprint(std::string_view in);
+	std::uint64_t fingerprint(std::istream& is);
+
+	struct SourceLocation {
+		std::uint64_t offset;	// From 0
+		std::uint64_t line;		// From 1
+		std::uint64_t column;	// From 1, in bytes
+	};
+
+	/**
+	 * Where the first comment in the input starts (at its first '/'), or nullopt if there are none. Nothing is output,
+	 * and input is read only up to the block holding that comment. The istream overload throws a runtime_error on I/O
+	 * failure.
+	 */
+	std::optional<SourceLocation> findFirstComment(std::string_view in);
+	std::optional<SourceLocation> findFirstComment(std::istream& is);
+
+	/**
+	 * Receives the comments that stripping removes, in input order. Each one's text arrives between beginComment() and
+	 * endComment(), in as many append() calls as it takes, exactly as it was in the input: from its first '/' to its
+	 * closing '/', or up to the newline (and any CR directly before it) that ends a single-line comment.
+	 */
+	class CommentSink {
+	public:
+		virtual ~CommentSink() = default;
+		virtual void beginComment(const SourceLocation& start) = 0;
+		virtual void append(const char* p, std::size_t n) = 0;
+		virtual void endComment() = 0;
+	};
+
+	/**
+	 * What stripping an input involved. Accumulates: each call that takes a StripStats adds to it.
+	 */
+	struct StripStats {
+		std::array<std::uint64_t, nStates> bytesInState{};	// Input bytes read in each State. Sums to inputBytes
+		std::uint64_t commentsRemoved = 0;
+		std::uint64_t continuationPairs = 0;	// Backslash-newline pairs
+		std::uint64_t inputBytes = 0;
+		std::uint64_t outputBytes = 0;
+		double elapsedSeconds = 0;
+
+		StripStats& operator+=(const StripStats& rhs);
+	};
+
+	/**
+	 * As the overloads above, additionally adding what was seen to stats. The overloads without stats pay nothing for
+	 * this: the counting is compiled into a separate instantiation of the stripping loop.
+	 */
+	void stripComments(std::istream& is, std::ostream& os, StripStats& stats);
+	void stripComments(std::istream& is, OutputSink& sink, StripStats& stats);
+	void stripComments(std::string_view in, std::string& out, StripStats& stats);
+
+	/**
+	 * As the overloads above, additionally replacing map with one saying which input bytes became which output bytes:
+	 * offsets are from the start of the input, and of the output this call adds. The overloads without a map pay
+	 * nothing for this, as with stats.
+	 */
+	void stripComments(std::istream& is, OutputSink& sink, OffsetMap& map);
+	void stripComments(std::string_view in, std::string& out, OffsetMap& map);
+
+	/**
+	 * As the overloads above, but passes each comment removed to comments as it is read, so that stripped code and
+	 * comments come from a single pass over the input. The overloads without comments pay nothing for this, as with
+	 * stats.
+	 */
+	void stripComments(std::istream& is, OutputSink& sink, CommentSink& comments);
+	void stripComments(std::istream& is, OutputSink& sink, CommentSink& comments, StripStats& stats);
+	void stripComments(std::string_view in, std::string& out, CommentSink& comments);
+	void stripComments(std::string_view in, std::string& out, CommentSink& comments, StripStats& stats);
+
+	/**
+	 * As stripComments(in, out), but splits in into chunks that are stripped concurrently on up to nThreads threads,
+	 * speculating about the state each chunk starts in. The output is identical to that of stripComments(in, out).
+	 * Inputs too small to benefit are stripped on the calling thread.
+	 */
+	void stripCommentsParallel(std::string_view in, std::string& out, unsigned nThreads);
 }
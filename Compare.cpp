@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include "ByteScanner.h"
+#include "CommentStripper.h"
+#include "Compare.h"
+
+using namespace std;
+
+namespace commentstripper {
+	namespace {
+		const size_t blockSize = 64 * 1024;
+
+		struct CountingSink {
+			uint64_t n;
+			void push_back(char) { ++n; }
+			void append(const char*, size_t k) { n += k; }
+		};
+
+		// One input, stripped a block at a time. Output not yet compared with the other input's waits in pending, and
+		// the next block is only read once it has all been compared, so pending never holds more than one block's
+		// output. The current block, and the stripper as it was before it, are kept so that a difference can be traced
+		// back to the input byte that produced it.
+		class Side {
+		public:
+			explicit Side(istream& is) : is(is) {}
+
+			string_view unconsumed() const {
+				return string_view(pending).substr(nConsumed);
+			}
+
+			void consume(size_t n) {
+				nConsumed += n;
+			}
+
+			bool finished() const {
+				return done;
+			}
+
+			void advance() {
+				countLines();
+				blockStart += block.size();
+				beforeBlock = stripper;
+				outputBeforeBlock = nOutput;
+
+				block.resize(blockSize);
+				is.read(&block[0], blockSize);
+				if (is.bad()) {
+					throw runtime_error{"An unexpected error occurred while reading input"};
+				}
+
+				block.resize(static_cast<size_t>(is.gcount()));
+				pending.clear();
+				nConsumed = 0;
+				stripper.feed(block, pending);
+				if (!is) {
+					stripper.finish(pending);
+					done = true;
+				}
+
+				nOutput += pending.size();
+			}
+
+			// Where the output byte at outputIndex, which is in or just past the current block's output, came from:
+			// replays the block a byte at a time until it appears.
+			SourceLocation locate(uint64_t outputIndex) const {
+				CommentStripper replay = beforeBlock;
+				CountingSink counter{ outputBeforeBlock };
+				size_t i = 0;
+				while (i < block.size() && counter.n <= outputIndex) {
+					replay.feed(string_view(&block[i++], 1), counter);
+				}
+
+				size_t offsetInBlock = counter.n > outputIndex ? i - 1 : block.size();
+				string_view before = string_view(block).substr(0, offsetInBlock);
+				size_t lastNewline = before.rfind('\n');
+				uint64_t lineStart = (lastNewline == string_view::npos ? lineStartBeforeBlock : blockStart + lastNewline + 1);
+				uint64_t offset = blockStart + offsetInBlock;
+				return { offset, linesBeforeBlock + count(before.begin(), before.end(), '\n') + 1, offset - lineStart + 1 };
+			}
+
+		private:
+			// Moves past the current block's lines.
+			void countLines() {
+				linesBeforeBlock += countByte(block.data(), block.data() + block.size(), '\n');
+				size_t lastNewline = block.rfind('\n');
+				if (lastNewline != string::npos) {
+					lineStartBeforeBlock = blockStart + lastNewline + 1;
+				}
+			}
+
+			istream& is;
+			CommentStripper stripper;
+			bool done = false;
+			string pending;
+			size_t nConsumed = 0;
+			uint64_t nOutput = 0;
+
+			string block;
+			uint64_t blockStart = 0;
+			CommentStripper beforeBlock;
+			uint64_t outputBeforeBlock = 0;
+			uint64_t linesBeforeBlock = 0;
+			uint64_t lineStartBeforeBlock = 0;
+		};
+	}
+
+	optional<Difference> findFirstDifference(istream& a, istream& b) {
+		Side sideA(a);
+		Side sideB(b);
+		uint64_t nCompared = 0;
+		for (;;) {
+			for (Side* side : { &sideA, &sideB }) {
+				while (side->unconsumed().empty() && !side->finished()) {
+					side->advance();
+				}
+			}
+
+			string_view x = sideA.unconsumed();
+			string_view y = sideB.unconsumed();
+			size_t n = min(x.size(), y.size());
+			size_t nSame = n;
+			if (memcmp(x.data(), y.data(), n) != 0) {
+				nSame = mismatch(x.begin(), x.begin() + n, y.begin()).first - x.begin();
+			}
+
+			if (nSame < n || (n == 0 && x.size() != y.size())) {	// A differing byte, or one output ended first
+				return Difference{ sideA.locate(nCompared + nSame), sideB.locate(nCompared + nSame) };
+			}
+
+			if (n == 0) {
+				return nullopt;
+			}
+
+			nCompared += n;
+			sideA.consume(n);
+			sideB.consume(n);
+		}
+	}
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <iostream>
+#include <optional>
+#include "CommentStripper.h"
+
+namespace commentstripper {
+	/**
+	 * Where two inputs' stripped outputs first differ, as locations in each input. A location is that of the input byte
+	 * whose reading produced the differing output byte: usually the byte itself, but a few bytes later for a '/' or
+	 * backslash-newline pair, whose output waits on what follows. An input whose output ended first is located at its
+	 * end.
+	 */
+	struct Difference {
+		SourceLocation a;
+		SourceLocation b;
+	};
+
+	/**
+	 * Finds whether a and b differ other than in comments, i.e. whether stripComments() would give different outputs,
+	 * without storing either output: the two are stripped a block at a time in lockstep, compared as they go, and
+	 * reading stops at the first difference. Memory use is constant. Throws a runtime_error on I/O failure.
+	 */
+	std::optional<Difference> findFirstDifference(std::istream& a, std::istream& b);
+}
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include "IncrementalStripper.h"
+
+using namespace std;
+
+namespace commentstripper {
+	IncrementalStripper::IncrementalStripper(string_view text, size_t checkpointInterval)
+		: checkpointInterval(max<size_t>(checkpointInterval, 1)), in(text) {
+		checkpoints.push_back({ 0, 0, Stripper() });
+		Stripper stripper;
+		feed(stripper, 0, in.size(), out, 0, checkpoints);
+		stripper.finish(out);
+	}
+
+	// Strips in[pos, end) into newOut, recording a checkpoint at each line start at least checkpointInterval bytes after
+	// the last one, but none at end itself.
+	void IncrementalStripper::feed(Stripper& stripper, size_t pos, size_t end, string& newOut, size_t outputBase,
+		vector<Checkpoint>& newCheckpoints) const {
+		while (pos < end) {
+			size_t next = end;
+			size_t searchFrom = max(pos, newCheckpoints.back().inputOffset + checkpointInterval - 1);
+			if (searchFrom < end) {
+				auto* newline = static_cast<const char*>(memchr(in.data() + searchFrom, '\n', end - searchFrom));
+				if (newline && newline + 1 < in.data() + end) {
+					next = newline + 1 - in.data();
+				}
+			}
+
+			stripper.feed(in.data() + pos, in.data() + next, newOut);
+			pos = next;
+			if (pos < end) {
+				newCheckpoints.push_back({ pos, outputBase + newOut.size(), stripper });
+			}
+		}
+	}
+
+	IncrementalStripper::OutputChange IncrementalStripper::edit(size_t offset, size_t removedLength, string_view inserted) {
+		if (offset > in.size() || removedLength > in.size() - offset) {
+			throw out_of_range{"edit range is outside the input"};
+		}
+
+		in.replace(offset, removedLength, inserted.data(), inserted.size());
+		size_t inputDelta = inserted.size() - removedLength;	// Wraps if negative, which the arithmetic below allows
+
+		// Everything before the last checkpoint at or before the edit is unchanged, so stripping can resume there. The
+		// old checkpoints from the end of the edit on are where the input is unchanged again (just shifted), so where
+		// the new and old runs may converge
+		size_t resume = upper_bound(checkpoints.begin(), checkpoints.end(), offset,
+			[](size_t o, const Checkpoint& checkpoint) { return o < checkpoint.inputOffset; }) - checkpoints.begin() - 1;
+		size_t candidate = lower_bound(checkpoints.begin(), checkpoints.end(), offset + removedLength,
+			[](const Checkpoint& checkpoint, size_t o) { return checkpoint.inputOffset < o; }) - checkpoints.begin();
+		candidate = max(candidate, resume + 1);
+
+		Stripper stripper = checkpoints[resume].stripper;
+		size_t outputBase = checkpoints[resume].outputOffset;
+		string newOut;
+		vector<Checkpoint> newCheckpoints{ checkpoints[resume] };
+		size_t pos = checkpoints[resume].inputOffset;
+		for (;; ++candidate) {
+			if (candidate == checkpoints.size()) {
+				feed(stripper, pos, in.size(), newOut, outputBase, newCheckpoints);
+				stripper.finish(newOut);
+				break;
+			}
+
+			size_t target = checkpoints[candidate].inputOffset + inputDelta;
+			feed(stripper, pos, target, newOut, outputBase, newCheckpoints);
+			pos = target;
+			if (stripper == checkpoints[candidate].stripper) {
+				break;
+			}
+
+			if (pos > newCheckpoints.back().inputOffset) {
+				newCheckpoints.push_back({ pos, outputBase + newOut.size(), stripper });
+			}
+		}
+
+		size_t oldOutputEnd = candidate == checkpoints.size() ? out.size() : checkpoints[candidate].outputOffset;
+		OutputChange change{ outputBase, oldOutputEnd - outputBase, newOut.size() };
+		out.replace(change.offset, change.removedLength, newOut);
+
+		for (size_t i = candidate; i < checkpoints.size(); ++i) {
+			checkpoints[i].inputOffset += inputDelta;
+			checkpoints[i].outputOffset += change.insertedLength - change.removedLength;
+		}
+
+		checkpoints.erase(checkpoints.begin() + resume, checkpoints.begin() + candidate);
+		checkpoints.insert(checkpoints.begin() + resume, newCheckpoints.begin(), newCheckpoints.end());
+		return change;
+	}
+}
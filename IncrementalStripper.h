@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Stripper.h"
+
+namespace commentstripper {
+	/**
+	 * Keeps a buffer and its stripped output up to date through edits, as an editor or indexer needs, without
+	 * re-stripping the whole buffer on every keystroke.
+	 *
+	 * While stripping, the stripper's complete state (State, backslashSeen, any raw string delimiter, and any
+	 * backslash-newline pairs whose fate isn't known yet) is recorded at checkpoints: line starts at least
+	 * checkpointInterval bytes apart. An edit resumes stripping from the last checkpoint before it. Past the edit, the
+	 * new state is compared with the old one at each of the old checkpoints; as soon as they match, the rest of the old
+	 * output is still right, and only the output in between is replaced. So an edit costs about checkpointInterval
+	 * bytes of stripping, unless it changes how much of what follows is in a comment or literal (e.g. typing a comment
+	 * opener), in which case stripping goes on until the states agree again, possibly to the end.
+	 */
+	class IncrementalStripper {
+	public:
+		/**
+		 * Where the output changed: removedLength bytes at offset were replaced by insertedLength bytes.
+		 */
+		struct OutputChange {
+			std::size_t offset;
+			std::size_t removedLength;
+			std::size_t insertedLength;
+		};
+
+		explicit IncrementalStripper(std::string_view text = {}, std::size_t checkpointInterval = 4096);
+
+		/**
+		 * Replaces the removedLength input bytes at offset with inserted, and updates output() to match. Throws an
+		 * out_of_range if the range isn't within input().
+		 */
+		OutputChange edit(std::size_t offset, std::size_t removedLength, std::string_view inserted);
+
+		const std::string& input() const {
+			return in;
+		}
+
+		/**
+		 * Always equal to what stripComments() would give for input().
+		 */
+		const std::string& output() const {
+			return out;
+		}
+
+	private:
+		struct Checkpoint {
+			std::size_t inputOffset;
+			std::size_t outputOffset;
+			Stripper stripper;	// As it was before reading the byte at inputOffset
+		};
+
+		void feed(Stripper& stripper, std::size_t pos, std::size_t end, std::string& newOut, std::size_t outputBase,
+			std::vector<Checkpoint>& newCheckpoints) const;
+
+		std::size_t checkpointInterval;
+		std::string in;
+		std::string out;
+		std::vector<Checkpoint> checkpoints;	// By inputOffset. The first is always at 0
+	};
+}
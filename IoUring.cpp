@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include "IoUring.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace commentstripper {
+	atomic<uint64_t> IoUring::systemCallCount{ 0 };
+
+	uint64_t IoUring::nSystemCalls() {
+		return systemCallCount.load();
+	}
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(IORING_FEAT_RW_CUR_POS)	// Headers from 5.6 on
+	namespace {
+		// The kernel and this thread share the rings, so index updates need acquire/release ordering.
+		unsigned loadAcquire(const unsigned* p) {
+			return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+		}
+
+		void storeRelease(unsigned* p, unsigned value) {
+			__atomic_store_n(p, value, __ATOMIC_RELEASE);
+		}
+
+		template <typename T>
+		T* at(void* base, unsigned offset) {
+			return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+		}
+
+		// Does the kernel support every operation we use? OPENAT and CLOSE arrived later than READ and WRITE.
+		bool supportsOps(int fd, string& reason) {
+			const unsigned nOps = 64;
+			vector<char> probeBuf(sizeof(io_uring_probe) + nOps * sizeof(io_uring_probe_op), 0);
+			auto* probe = reinterpret_cast<io_uring_probe*>(probeBuf.data());
+			if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, nOps) < 0) {
+				reason = string("io_uring probe failed: ") + strerror(errno);
+				return false;
+			}
+
+			for (unsigned op : { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE }) {
+				if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+					reason = "kernel io_uring lacks a needed operation";
+					return false;
+				}
+			}
+
+			return true;
+		}
+	}
+
+	IoUring::IoUring(unsigned nEntries) {
+		io_uring_params params;
+		memset(&params, 0, sizeof params);
+		int ringFd = static_cast<int>(syscall(__NR_io_uring_setup, nEntries, &params));
+		if (ringFd < 0) {
+			reason = string("io_uring_setup failed: ") + strerror(errno);
+			return;
+		}
+
+		if (!supportsOps(ringFd, reason)) {
+			close(ringFd);
+			return;
+		}
+
+		sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (singleMmap) {
+			sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+		}
+
+		sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+		if (sqRing == MAP_FAILED) {
+			sqRing = nullptr;
+		} else if (singleMmap) {
+			cqRing = sqRing;
+		} else {
+			cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+			cqRing = (cqRing == MAP_FAILED ? nullptr : cqRing);
+		}
+
+		sqes = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+		sqes = (sqes == MAP_FAILED ? nullptr : sqes);
+
+		if (!sqRing || !cqRing || !sqes) {
+			reason = string("could not map io_uring rings: ") + strerror(errno);
+			release();
+			close(ringFd);
+			return;
+		}
+
+		sqHead = at<unsigned>(sqRing, params.sq_off.head);
+		sqTail = at<unsigned>(sqRing, params.sq_off.tail);
+		sqMask = *at<unsigned>(sqRing, params.sq_off.ring_mask);
+		sqEntries = *at<unsigned>(sqRing, params.sq_off.ring_entries);
+		sqArray = at<unsigned>(sqRing, params.sq_off.array);
+		cqHead = at<unsigned>(cqRing, params.cq_off.head);
+		cqTail = at<unsigned>(cqRing, params.cq_off.tail);
+		cqMask = *at<unsigned>(cqRing, params.cq_off.ring_mask);
+		cqes = at<io_uring_cqe>(cqRing, params.cq_off.cqes);
+		fd = ringFd;
+	}
+
+	IoUring::~IoUring() {
+		release();
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+	void IoUring::release() {
+		if (sqes) {
+			munmap(sqes, sqesSize);
+		}
+
+		if (cqRing && cqRing != sqRing) {
+			munmap(cqRing, cqRingSize);
+		}
+
+		if (sqRing) {
+			munmap(sqRing, sqRingSize);
+		}
+
+		sqRing = cqRing = sqes = nullptr;
+	}
+
+	void* IoUring::getSqe() {
+		unsigned tail = *sqTail;	// Only we write it
+		if (tail - loadAcquire(sqHead) == sqEntries) {
+			return nullptr;
+		}
+
+		io_uring_sqe* sqe = static_cast<io_uring_sqe*>(sqes) + (tail & sqMask);
+		memset(sqe, 0, sizeof *sqe);
+		sqArray[tail & sqMask] = tail & sqMask;
+		return sqe;
+	}
+
+	namespace {
+		bool queue(void* p, unsigned* sqTail, unsigned& nToSubmit, uint8_t opcode, int fd, uint64_t addr, unsigned len,
+			uint64_t offset, uint64_t userData) {
+			auto* sqe = static_cast<io_uring_sqe*>(p);
+			if (!sqe) {
+				return false;
+			}
+
+			sqe->opcode = opcode;
+			sqe->fd = fd;
+			sqe->addr = addr;
+			sqe->len = len;
+			sqe->off = offset;
+			sqe->user_data = userData;
+			storeRelease(sqTail, *sqTail + 1);
+			++nToSubmit;
+			return true;
+		}
+	}
+
+	bool IoUring::prepOpen(const char* path, int flags, unsigned mode, uint64_t userData) {
+		auto* sqe = static_cast<io_uring_sqe*>(getSqe());
+		if (sqe) {
+			sqe->open_flags = static_cast<uint32_t>(flags);
+		}
+
+		return queue(sqe, sqTail, nToSubmit, IORING_OP_OPENAT, AT_FDCWD, reinterpret_cast<uint64_t>(path), mode, 0, userData);
+	}
+
+	bool IoUring::prepRead(int fileFd, char* buf, unsigned n, uint64_t offset, uint64_t userData) {
+		return queue(getSqe(), sqTail, nToSubmit, IORING_OP_READ, fileFd, reinterpret_cast<uint64_t>(buf), n, offset, userData);
+	}
+
+	bool IoUring::prepWrite(int fileFd, const char* buf, unsigned n, uint64_t offset, uint64_t userData) {
+		return queue(getSqe(), sqTail, nToSubmit, IORING_OP_WRITE, fileFd, reinterpret_cast<uint64_t>(buf), n, offset, userData);
+	}
+
+	bool IoUring::prepClose(int fileFd, uint64_t userData) {
+		return queue(getSqe(), sqTail, nToSubmit, IORING_OP_CLOSE, fileFd, 0, 0, 0, userData);
+	}
+
+	void IoUring::submitAndWait(unsigned minComplete) {
+		for (;;) {
+			++systemCallCount;
+			long n = syscall(__NR_io_uring_enter, fd, nToSubmit, minComplete, IORING_ENTER_GETEVENTS, nullptr, 0);
+			if (n >= 0) {
+				nToSubmit -= static_cast<unsigned>(n);
+				return;
+			}
+
+			if (errno != EINTR) {
+				throw runtime_error{string("io_uring_enter failed: ") + strerror(errno)};
+			}
+		}
+	}
+
+	bool IoUring::popCompletion(uint64_t& userData, int32_t& result) {
+		unsigned head = *cqHead;	// Only we write it
+		if (head == loadAcquire(cqTail)) {
+			return false;
+		}
+
+		const io_uring_cqe& cqe = static_cast<io_uring_cqe*>(cqes)[head & cqMask];
+		userData = cqe.user_data;
+		result = cqe.res;
+		storeRelease(cqHead, head + 1);
+		return true;
+	}
+#else
+	IoUring::IoUring(unsigned) : reason("io_uring support was not compiled in") {}
+	IoUring::~IoUring() {}
+	void IoUring::release() {}
+	bool IoUring::prepOpen(const char*, int, unsigned, uint64_t) { return false; }
+	bool IoUring::prepRead(int, char*, unsigned, uint64_t, uint64_t) { return false; }
+	bool IoUring::prepWrite(int, const char*, unsigned, uint64_t, uint64_t) { return false; }
+	bool IoUring::prepClose(int, uint64_t) { return false; }
+	void IoUring::submitAndWait(unsigned) {}
+	void* IoUring::getSqe() { return nullptr; }
+	bool IoUring::popCompletion(uint64_t&, int32_t&) { return false; }
+#endif
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace commentstripper {
+	/**
+	 * A minimal io_uring submission/completion queue pair, driven by raw system calls (no liburing needed), offering just
+	 * the operations batch stripping needs. Requests are queued with the prep*() functions, each tagged with a caller-
+	 * chosen userData, and are handed to the kernel together by submitAndWait(). Where io_uring is unavailable -- other
+	 * platforms, kernels before 5.6, or sandboxes that forbid it -- available() returns false and nothing else may be
+	 * called.
+	 *
+	 * Not thread-safe: use one per thread.
+	 */
+	class IoUring {
+	public:
+		explicit IoUring(unsigned nEntries);
+		~IoUring();
+		IoUring(const IoUring&) = delete;
+		IoUring& operator=(const IoUring&) = delete;
+
+		bool available() const {
+			return fd >= 0;
+		}
+
+		const std::string& unavailableReason() const {
+			return reason;
+		}
+
+		// Each returns false, queueing nothing, if the submission queue is full. path and buf must stay valid until the
+		// request completes.
+		bool prepOpen(const char* path, int flags, unsigned mode, std::uint64_t userData);
+		bool prepRead(int fileFd, char* buf, unsigned n, std::uint64_t offset, std::uint64_t userData);
+		bool prepWrite(int fileFd, const char* buf, unsigned n, std::uint64_t offset, std::uint64_t userData);
+		bool prepClose(int fileFd, std::uint64_t userData);
+
+		/**
+		 * Submits everything queued, then waits until at least minComplete requests have completed. Throws a
+		 * runtime_error on failure.
+		 */
+		void submitAndWait(unsigned minComplete);
+
+		/**
+		 * Calls onCompletion(userData, result) for each completed request, where result is what the equivalent system
+		 * call would have returned, or -errno. Returns the number of completions.
+		 */
+		template <typename OnCompletion>
+		unsigned reap(OnCompletion&& onCompletion) {
+			unsigned n = 0;
+			std::uint64_t userData;
+			std::int32_t result;
+			while (popCompletion(userData, result)) {
+				onCompletion(userData, result);
+				++n;
+			}
+
+			return n;
+		}
+
+		/**
+		 * The number of io_uring_enter() system calls made by every IoUring so far, for measuring batching.
+		 */
+		static std::uint64_t nSystemCalls();
+
+	private:
+		void release();	// Unmaps the rings
+		void* getSqe();
+		bool popCompletion(std::uint64_t& userData, std::int32_t& result);
+
+		int fd = -1;
+		std::string reason;
+		unsigned nToSubmit = 0;
+
+		void* sqRing = nullptr;
+		void* cqRing = nullptr;
+		void* sqes = nullptr;
+		std::size_t sqRingSize = 0;
+		std::size_t cqRingSize = 0;
+		std::size_t sqesSize = 0;
+
+		unsigned* sqHead = nullptr;
+		unsigned* sqTail = nullptr;
+		unsigned sqMask = 0;
+		unsigned sqEntries = 0;
+		unsigned* sqArray = nullptr;
+		unsigned* cqHead = nullptr;
+		unsigned* cqTail = nullptr;
+		unsigned cqMask = 0;
+		void* cqes = nullptr;
+
+		static std::atomic<std::uint64_t> systemCallCount;
+	};
+}
@@ -0,0 +1,47 @@
+#include "MappedFile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0	// Linux only
+#endif
+
+using namespace std;
+
+namespace commentstripper {
+#ifndef _WIN32
+	MappedFile::MappedFile(const string& path) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return;
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+			// Fault every page in up front: much cheaper than one page fault at a time during stripping
+			void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+			if (p != MAP_FAILED) {
+				madvise(p, st.st_size, MADV_SEQUENTIAL);	// Just a hint
+				data = static_cast<const char*>(p);
+				size = st.st_size;
+			}
+		}
+
+		close(fd);	// The mapping keeps the file open
+	}
+
+	MappedFile::~MappedFile() {
+		if (data) {
+			munmap(const_cast<char*>(data), size);
+		}
+	}
+#else
+	MappedFile::MappedFile(const string&) {}
+	MappedFile::~MappedFile() {}
+#endif
+}
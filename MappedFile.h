@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace commentstripper {
+	/**
+	 * A regular file mapped read-only into memory with mmap(), for stripping large files without copying them into a
+	 * buffer first. Anything that can't be mapped -- pipes, terminals, empty files, or any file on platforms without
+	 * mmap() -- leaves the object unmapped, so the caller can fall back to streaming. Never throws.
+	 *
+	 * As with any mapping, the file must not be truncated while mapped.
+	 */
+	class MappedFile {
+	public:
+		explicit MappedFile(const std::string& path);
+		~MappedFile();
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		bool isMapped() const {
+			return data != nullptr;
+		}
+
+		std::string_view contents() const {
+			return { data, size };
+		}
+
+	private:
+		const char* data = nullptr;
+		std::size_t size = 0;
+	};
+}
@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <stdexcept>
+#include "OffsetMap.h"
+
+using namespace std;
+
+namespace commentstripper {
+	namespace {
+		uint64_t outputLengthOf(OffsetMap::Kind kind, uint64_t inputLength) {
+			switch (kind) {
+			case OffsetMap::Kind::KEPT: return inputLength;
+			case OffsetMap::Kind::REPLACED: return 1;
+			default: return 0;
+			}
+		}
+
+		void putVarint(string& s, uint64_t v) {
+			while (v >= 0x80) {
+				s.push_back(static_cast<char>(v | 0x80));
+				v >>= 7;
+			}
+			s.push_back(static_cast<char>(v));
+		}
+
+		// Decodes the varint at s[i], advancing i past it.
+		uint64_t getVarint(string_view s, size_t& i) {
+			uint64_t v = 0;
+			for (unsigned shift = 0; shift < 64; shift += 7) {
+				if (i == s.size()) {
+					throw runtime_error{"Offset map is truncated"};
+				}
+
+				unsigned char b = static_cast<unsigned char>(s[i++]);
+				v |= static_cast<uint64_t>(b & 0x7F) << shift;
+				if (b < 0x80) {
+					return v;
+				}
+			}
+
+			throw runtime_error{"Offset map has an overlong run length"};
+		}
+	}
+
+	OffsetMap::OffsetMap(string_view encoded) {
+		for (size_t i = 0; i < encoded.size(); ) {
+			uint64_t v = getVarint(encoded, i);
+			if ((v & 3) > static_cast<uint64_t>(Kind::REPLACED) || (v >> 2) == 0) {
+				throw runtime_error{"Offset map has an invalid run"};
+			}
+
+			append(static_cast<Kind>(v & 3), v >> 2);
+		}
+	}
+
+	string OffsetMap::encoded() const {
+		string s = bytes;
+		if (runCount) {
+			putVarint(s, lastRun.inputLength << 2 | static_cast<uint64_t>(lastRun.kind));
+		}
+
+		return s;
+	}
+
+	void OffsetMap::commitLastRun() {
+		if ((runCount - 1) % indexInterval == 0) {
+			index.push_back({ lastRun.inputOffset, lastRun.outputOffset, bytes.size() });
+		}
+
+		putVarint(bytes, lastRun.inputLength << 2 | static_cast<uint64_t>(lastRun.kind));
+	}
+
+	void OffsetMap::append(Kind kind, uint64_t inputLength) {
+		if (inputLength == 0) {
+			return;
+		}
+
+		if (runCount && lastRun.kind == kind && kind != Kind::REPLACED) {
+			lastRun.inputLength += inputLength;
+			lastRun.outputLength = outputLengthOf(kind, lastRun.inputLength);
+			return;
+		}
+
+		uint64_t inputOffset = inputSize();
+		uint64_t outputOffset = outputSize();
+		if (runCount) {
+			commitLastRun();
+		}
+
+		lastRun = { kind, inputOffset, inputLength, outputOffset, outputLengthOf(kind, inputLength) };
+		++runCount;
+	}
+
+	void OffsetMap::retract(uint64_t n) {
+		if (n > lastRun.inputLength || (lastRun.kind == Kind::REPLACED && n)) {
+			throw out_of_range{"can only retract bytes of the last run, if not REPLACED"};
+		}
+
+		lastRun.inputLength -= n;
+		lastRun.outputLength = outputLengthOf(lastRun.kind, lastRun.inputLength);
+		if (lastRun.inputLength || !runCount) {
+			return;
+		}
+
+		// The last run is gone: reopen the one before it. Every byte of a varint but its last has the top bit set, so it
+		// starts just after the previous byte that doesn't
+		if (--runCount == 0) {
+			lastRun = { Kind::KEPT, 0, 0, 0, 0 };
+			return;
+		}
+
+		size_t start = bytes.size() - 1;
+		while (start > 0 && static_cast<unsigned char>(bytes[start - 1]) >= 0x80) {
+			--start;
+		}
+
+		size_t i = start;
+		uint64_t v = getVarint(bytes, i);
+		Kind kind = static_cast<Kind>(v & 3);
+		uint64_t inputLength = v >> 2;
+		uint64_t outputLength = outputLengthOf(kind, inputLength);
+		lastRun = { kind, lastRun.inputOffset - inputLength, inputLength, lastRun.outputOffset - outputLength, outputLength };
+
+		bytes.resize(start);
+		if (!index.empty() && index.back().byteOffset == start) {
+			index.pop_back();
+		}
+	}
+
+	template <typename Done>
+	OffsetMap::Run OffsetMap::scan(size_t i, Done&& done) const {
+		Run run{ Kind::KEPT, index[i].inputOffset, 0, index[i].outputOffset, 0 };
+		for (size_t pos = index[i].byteOffset; pos < bytes.size(); ) {
+			uint64_t v = getVarint(bytes, pos);
+			run.kind = static_cast<Kind>(v & 3);
+			run.inputLength = v >> 2;
+			run.outputLength = outputLengthOf(run.kind, run.inputLength);
+			if (done(run)) {
+				return run;
+			}
+
+			run.inputOffset += run.inputLength;
+			run.outputOffset += run.outputLength;
+		}
+
+		return lastRun;
+	}
+
+	OffsetMap::Run OffsetMap::runAtInput(uint64_t inputOffset) const {
+		if (inputOffset >= inputSize()) {
+			throw out_of_range{"input offset is past the end of the map"};
+		}
+
+		if (inputOffset >= lastRun.inputOffset) {
+			return lastRun;
+		}
+
+		size_t i = upper_bound(index.begin(), index.end(), inputOffset,
+			[](uint64_t o, const IndexEntry& entry) { return o < entry.inputOffset; }) - index.begin() - 1;
+		return scan(i, [&](const Run& run) { return inputOffset < run.inputOffset + run.inputLength; });
+	}
+
+	OffsetMap::Run OffsetMap::runAtOutput(uint64_t outputOffset) const {
+		if (outputOffset >= outputSize()) {
+			throw out_of_range{"output offset is past the end of the map"};
+		}
+
+		if (outputOffset >= lastRun.outputOffset) {
+			return lastRun;
+		}
+
+		size_t i = upper_bound(index.begin(), index.end(), outputOffset,
+			[](uint64_t o, const IndexEntry& entry) { return o < entry.outputOffset; }) - index.begin() - 1;
+		return scan(i, [&](const Run& run) { return outputOffset < run.outputOffset + run.outputLength; });
+	}
+
+	uint64_t OffsetMap::toOutput(uint64_t inputOffset) const {
+		if (inputOffset == inputSize()) {
+			return outputSize();
+		}
+
+		Run run = runAtInput(inputOffset);
+		return run.outputOffset + (run.kind == Kind::KEPT ? inputOffset - run.inputOffset : 0);
+	}
+
+	uint64_t OffsetMap::toInput(uint64_t outputOffset) const {
+		if (outputOffset == outputSize()) {
+			return inputSize();
+		}
+
+		Run run = runAtOutput(outputOffset);
+		return run.inputOffset + (run.kind == Kind::KEPT ? outputOffset - run.outputOffset : 0);
+	}
+}
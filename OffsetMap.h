@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace commentstripper {
+	/**
+	 * Which input bytes a stripped output came from, so that positions in the output can be traced back to the original
+	 * (e.g. for diagnostics) and vice versa. The input is divided into runs, each kept (copied to the output as is),
+	 * dropped (a single-line comment, say) or replaced (a multiline comment, by a single space).
+	 *
+	 * Stored compactly: each run is one LEB128 varint, (inputLength << 2 | kind), and positions are implied by the
+	 * lengths before it. Every indexInterval runs, the absolute input and output offsets are noted in an index, so that
+	 * lookups in either direction are a binary search followed by decoding at most indexInterval runs.
+	 */
+	class OffsetMap {
+	public:
+		enum class Kind : std::uint8_t {
+			KEPT,
+			DROPPED,
+			REPLACED
+		};
+
+		struct Run {
+			Kind kind;
+			std::uint64_t inputOffset;
+			std::uint64_t inputLength;
+			std::uint64_t outputOffset;
+			std::uint64_t outputLength;	// inputLength if KEPT, 0 if DROPPED, 1 if REPLACED
+		};
+
+		OffsetMap() = default;
+
+		/**
+		 * Decodes a map previously returned by encoded(). Throws a runtime_error if it is malformed.
+		 */
+		explicit OffsetMap(std::string_view encoded);
+
+		std::string encoded() const;
+
+		std::uint64_t inputSize() const {
+			return lastRun.inputOffset + lastRun.inputLength;
+		}
+
+		std::uint64_t outputSize() const {
+			return lastRun.outputOffset + lastRun.outputLength;
+		}
+
+		/**
+		 * The run holding the given input byte, which must be less than inputSize().
+		 */
+		Run runAtInput(std::uint64_t inputOffset) const;
+
+		/**
+		 * The run that produced the given output byte, which must be less than outputSize().
+		 */
+		Run runAtOutput(std::uint64_t outputOffset) const;
+
+		/**
+		 * Where the given input byte ended up in the output. Dropped bytes map to where they would have been, and bytes
+		 * in a replaced comment to the space that replaced it. inputSize() maps to outputSize().
+		 */
+		std::uint64_t toOutput(std::uint64_t inputOffset) const;
+
+		/**
+		 * Where the given output byte came from in the input. The space replacing a comment maps to the comment's start.
+		 * outputSize() maps to inputSize().
+		 */
+		std::uint64_t toInput(std::uint64_t outputOffset) const;
+
+		std::size_t nRuns() const {
+			return runCount;
+		}
+
+		// For building a map while stripping: append() adds input bytes at the end, merging them into the last run if
+		// it is of the same kind (except for REPLACED runs, which are one per comment), and retract() takes back the
+		// last n bytes, which must all be in the last run.
+		void append(Kind kind, std::uint64_t inputLength);
+		void retract(std::uint64_t n);
+
+	private:
+		static const std::size_t indexInterval = 32;
+
+		struct IndexEntry {
+			std::uint64_t inputOffset;
+			std::uint64_t outputOffset;
+			std::size_t byteOffset;	// Into bytes
+		};
+
+		void commitLastRun();
+
+		// Decodes runs starting from index entry i, until done(run) is true; the last run is not in bytes.
+		template <typename Done>
+		Run scan(std::size_t i, Done&& done) const;
+
+		std::string bytes;	// Every run but the last, encoded
+		std::vector<IndexEntry> index;	// Of the runs in bytes
+		std::size_t runCount = 0;
+		Run lastRun{ Kind::KEPT, 0, 0, 0, 0 };	// Still open to merging. Empty only if there are no runs
+	};
+}
@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <string>
+#include "OutputSink.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace commentstripper {
+	OutputSink::OutputSink(size_t bufferSize) : buffer(new char[bufferSize]), capacity(bufferSize) {
+		if (bufferSize == 0) {
+			throw invalid_argument{"OutputSink needs a non-empty buffer"};
+		}
+	}
+
+	void OutputSink::flush() {
+		flushBuffer();
+	}
+
+	void OutputSink::flushQuietly() noexcept {
+		try {
+			flushBuffer();
+		} catch (...) {
+		}
+	}
+
+	void OutputSink::flushBuffer() {
+		if (used) {
+			size_t n = used;
+			used = 0;	// Even if write() throws, don't write the same bytes twice
+			nWritten += n;
+			write(buffer.get(), n);
+		}
+	}
+
+	// A run too big to buffer at all is written directly. Otherwise top up and flush the buffer, then buffer the rest.
+	void OutputSink::appendSlow(const char* p, size_t n) {
+		if (n >= capacity) {
+			flushBuffer();
+			nWritten += n;
+			write(p, n);
+			return;
+		}
+
+		size_t nFirst = capacity - used;
+		memcpy(buffer.get() + used, p, nFirst);
+		used += nFirst;
+		p += nFirst;
+		n -= nFirst;
+		flushBuffer();
+		memcpy(buffer.get(), p, n);
+		used = n;
+	}
+
+	void FdOutputSink::write(const char* p, size_t n) {
+		while (n) {
+#ifdef _WIN32
+			int nWritten = _write(fd, p, static_cast<unsigned>(min<size_t>(n, 1 << 30)));
+#else
+			ssize_t nWritten = ::write(fd, p, n);
+#endif
+			if (nWritten < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+
+				throw runtime_error{string("Could not write output: ") + strerror(errno)};
+			}
+
+			p += nWritten;
+			n -= nWritten;
+		}
+	}
+
+	void OstreamOutputSink::write(const char* p, size_t n) {
+		os.write(p, n);
+		if (!os) {
+			throw runtime_error{"Could not write output"};
+		}
+	}
+
+	WritevOutputSink::WritevOutputSink(int fd, const char* begin, const char* end, size_t bufferSize)
+		: fd(fd), begin(begin), end(end), buffer(new char[bufferSize]), capacity(bufferSize) {
+		if (bufferSize == 0) {
+			throw invalid_argument{"WritevOutputSink needs a non-empty buffer"};
+		}
+
+		slices.reserve(maxSlices);
+	}
+
+	WritevOutputSink::~WritevOutputSink() {
+		try {
+			flush();
+		} catch (...) {
+		}
+	}
+
+	void WritevOutputSink::endCopiedSlice() {
+		if (used != copiedStart) {
+			slices.push_back({ buffer.get() + copiedStart, used - copiedStart });
+			nReferenced += used - copiedStart;
+			copiedStart = used;
+		}
+	}
+
+	// Either [p, p + n) is a long run inside [begin, end), to be passed by reference, or it doesn't fit in the buffer.
+	void WritevOutputSink::appendSlow(const char* p, size_t n) {
+		if (n >= minReferencedRun && p >= begin && p + n <= end) {
+			if (slices.size() + 2 > maxSlices) {
+				flush();
+			}
+
+			endCopiedSlice();
+			slices.push_back({ p, n });
+			nReferenced += n;
+			return;
+		}
+
+		while (n) {
+			if (used == capacity) {
+				flush();
+			}
+
+			size_t nCopied = min(n, capacity - used);
+			memcpy(buffer.get() + used, p, nCopied);
+			used += nCopied;
+			p += nCopied;
+			n -= nCopied;
+		}
+	}
+
+	// The buffer may only be reused once the kernel has taken everything in it, so all slices go at once.
+	void WritevOutputSink::flush() {
+		endCopiedSlice();
+		vector<Slice> pending(slices);
+		slices.clear();	// Even if writing throws, don't write the same bytes twice
+		used = copiedStart = 0;
+		nWritten += nReferenced;
+		nReferenced = 0;
+
+#ifdef _WIN32
+		for (const Slice& slice : pending) {
+			const char* p = slice.p;
+			size_t n = slice.n;
+			while (n) {
+				int nDone = _write(fd, p, static_cast<unsigned>(min<size_t>(n, 1 << 30)));
+				if (nDone < 0) {
+					throw runtime_error{string("Could not write output: ") + strerror(errno)};
+				}
+
+				p += nDone;
+				n -= nDone;
+			}
+		}
+#else
+		vector<iovec> iov(pending.size());
+		for (size_t i = 0; i < pending.size(); ++i) {
+			iov[i] = { const_cast<char*>(pending[i].p), pending[i].n };
+		}
+
+		iovec* next = iov.data();
+		iovec* last = iov.data() + iov.size();
+		while (next != last) {
+			ssize_t nDone = writev(fd, next, static_cast<int>(last - next));
+			if (nDone < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+
+				throw runtime_error{string("Could not write output: ") + strerror(errno)};
+			}
+
+			// Skip the slices written in full, then the written part of a partially written one
+			for (; next != last && static_cast<size_t>(nDone) >= next->iov_len; ++next) {
+				nDone -= next->iov_len;
+			}
+
+			if (next != last) {
+				next->iov_base = static_cast<char*>(next->iov_base) + nDone;
+				next->iov_len -= nDone;
+			}
+		}
+#endif
+	}
+}
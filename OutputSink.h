@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace commentstripper {
+	/**
+	 * A destination for stripped output that collects it in a large buffer and hands it on in big writes. Output is
+	 * mostly appended in runs (everything between two interesting bytes), so append() is a bounds check and a memcpy
+	 * in the common case; runs too big for the buffer bypass it. Can be passed anywhere a sink is expected, e.g. to
+	 * CommentStripper::feed().
+	 *
+	 * Call flush() once all output has been appended: destroying a sink flushes too, but has to ignore errors.
+	 */
+	class OutputSink {
+	public:
+		explicit OutputSink(std::size_t bufferSize = 256 * 1024);
+		virtual ~OutputSink() = default;
+
+		OutputSink(const OutputSink&) = delete;
+		OutputSink& operator=(const OutputSink&) = delete;
+
+		void push_back(char c) {
+			if (used == capacity) {
+				flushBuffer();
+			}
+
+			buffer[used++] = c;
+		}
+
+		void append(const char* p, std::size_t n) {
+			if (n <= capacity - used) {
+				std::memcpy(buffer.get() + used, p, n);
+				used += n;
+			} else {
+				appendSlow(p, n);
+			}
+		}
+
+		/**
+		 * Writes out everything appended so far. Throws a runtime_error on I/O failure.
+		 */
+		void flush();
+
+		/**
+		 * The total number of bytes appended, whether or not they have been written out yet.
+		 */
+		std::uint64_t size() const {
+			return nWritten + used;
+		}
+
+	protected:
+		/**
+		 * Writes all of [p, p + n) to the destination, or throws a runtime_error.
+		 */
+		virtual void write(const char* p, std::size_t n) = 0;
+
+		/**
+		 * For derived class destructors: flushes, swallowing any error.
+		 */
+		void flushQuietly() noexcept;
+
+	private:
+		void flushBuffer();
+		void appendSlow(const char* p, std::size_t n);
+
+		std::unique_ptr<char[]> buffer;
+		std::size_t capacity;
+		std::size_t used = 0;
+		std::uint64_t nWritten = 0;
+	};
+
+	/**
+	 * Writes straight to a file descriptor with write(2), retrying short writes and EINTR, bypassing iostreams entirely.
+	 * Does not take ownership of fd.
+	 */
+	class FdOutputSink : public OutputSink {
+	public:
+		explicit FdOutputSink(int fd, std::size_t bufferSize = 256 * 1024) : OutputSink(bufferSize), fd(fd) {}
+		~FdOutputSink() override { flushQuietly(); }
+
+	protected:
+		void write(const char* p, std::size_t n) override;
+
+	private:
+		int fd;
+	};
+
+	/**
+	 * Adapts a std::ostream, for compatibility: each write is a single os.write() of a whole buffer.
+	 */
+	class OstreamOutputSink : public OutputSink {
+	public:
+		explicit OstreamOutputSink(std::ostream& os, std::size_t bufferSize = 64 * 1024) : OutputSink(bufferSize), os(os) {}
+		~OstreamOutputSink() override { flushQuietly(); }
+
+	protected:
+		void write(const char* p, std::size_t n) override;
+
+	private:
+		std::ostream& os;
+	};
+
+	/**
+	 * Writes to a file descriptor with writev(2), passing long runs that lie inside the read-only buffer [begin, end)
+	 * -- typically a MappedFile -- as pointers into it, rather than copying them. Everything else (single characters,
+	 * short runs, runs from elsewhere) is copied into a buffer, as with OutputSink. Stripping a mapped file into one of
+	 * these copies long comment-free stretches of input out of the mapping only once, in the kernel. [begin, end) must
+	 * stay valid and unchanged until flush() returns.
+	 */
+	class WritevOutputSink {
+	public:
+		WritevOutputSink(int fd, const char* begin, const char* end, std::size_t bufferSize = 256 * 1024);
+		~WritevOutputSink();
+
+		WritevOutputSink(const WritevOutputSink&) = delete;
+		WritevOutputSink& operator=(const WritevOutputSink&) = delete;
+
+		void push_back(char c) {
+			if (used == capacity) {
+				flush();
+			}
+
+			buffer[used++] = c;
+		}
+
+		void append(const char* p, std::size_t n) {
+			if (n <= capacity - used && (n < minReferencedRun || p < begin || p + n > end)) {
+				std::memcpy(buffer.get() + used, p, n);
+				used += n;
+			} else {
+				appendSlow(p, n);
+			}
+		}
+
+		/**
+		 * Writes out everything appended so far. Throws a runtime_error on I/O failure.
+		 */
+		void flush();
+
+		std::uint64_t size() const {
+			return nWritten + nReferenced + (used - copiedStart);
+		}
+
+	private:
+		struct Slice {
+			const char* p;
+			std::size_t n;
+		};
+
+		static constexpr std::size_t minReferencedRun = 4096;	// Measured: shorter runs are cheaper to copy than to pass
+		static constexpr std::size_t maxSlices = 1024;			// The usual IOV_MAX
+
+		void endCopiedSlice();
+		void appendSlow(const char* p, std::size_t n);
+
+		int fd;
+		const char* begin;
+		const char* end;
+		std::unique_ptr<char[]> buffer;
+		std::size_t capacity;
+		std::size_t used = 0;
+		std::size_t copiedStart = 0;	// buffer[copiedStart, used) is not yet in slices
+		std::vector<Slice> slices;
+		std::uint64_t nReferenced = 0;	// Bytes in slices, not yet written
+		std::uint64_t nWritten = 0;
+	};
+}
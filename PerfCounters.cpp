@@ -0,0 +1,122 @@
+#include <cstring>
+#include "PerfCounters.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstdint>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace commentstripper {
+#ifdef __linux__
+	namespace {
+		int openCounter(uint32_t type, uint64_t config) {
+			perf_event_attr attr;
+			memset(&attr, 0, sizeof attr);
+			attr.size = sizeof attr;
+			attr.type = type;
+			attr.config = config;
+			attr.disabled = 1;
+			attr.inherit = 1;			// Include threads started while counting, e.g. by --threads
+			attr.exclude_kernel = 1;	// Needed at the default perf_event_paranoid level, and kernel time isn't ours anyway
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+		}
+	}
+
+	PerfCounters::PerfCounters() {
+		const pair<uint32_t, uint64_t> events[N_EVENTS] = {
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+			{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+		};
+
+		for (int e = 0; e < N_EVENTS; ++e) {
+			fds[e] = openCounter(events[e].first, events[e].second);
+			if (fds[e] < 0 && reason.empty()) {
+				reason = string("perf_event_open() failed for ") + name(static_cast<Event>(e)) + ": " + strerror(errno);
+			}
+		}
+	}
+
+	PerfCounters::~PerfCounters() {
+		for (int fd : fds) {
+			if (fd >= 0) {
+				close(fd);
+			}
+		}
+	}
+
+	void PerfCounters::start() {
+		for (int fd : fds) {
+			if (fd >= 0) {
+				ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+				ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+		}
+	}
+
+	void PerfCounters::stop() {
+		for (int fd : fds) {
+			if (fd >= 0) {
+				ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+			}
+		}
+	}
+
+	PerfCounters::Reading PerfCounters::read() const {
+		Reading reading;
+		for (int e = 0; e < N_EVENTS; ++e) {
+			uint64_t values[3];	// value, time enabled, time running
+			if (fds[e] >= 0 && ::read(fds[e], values, sizeof values) == sizeof values && values[2] > 0) {
+				reading[e] = static_cast<double>(values[0]) * values[1] / values[2];
+			}
+		}
+
+		return reading;
+	}
+#else
+	PerfCounters::PerfCounters() : reason("hardware performance counters are only supported on Linux") {
+		fds.fill(-1);
+	}
+
+	PerfCounters::~PerfCounters() {}
+	void PerfCounters::start() {}
+	void PerfCounters::stop() {}
+
+	PerfCounters::Reading PerfCounters::read() const {
+		return Reading();
+	}
+#endif
+
+	bool PerfCounters::anyAvailable() const {
+		for (int fd : fds) {
+			if (fd >= 0) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	const string& PerfCounters::unavailableReason() const {
+		return reason;
+	}
+
+	const char* PerfCounters::name(Event e) {
+		switch (e) {
+		case CYCLES: return "cycles";
+		case INSTRUCTIONS: return "instructions";
+		case BRANCH_MISSES: return "branch-misses";
+		case L1D_READ_MISSES: return "L1d-read-misses";
+		default: return "?";
+		}
+	}
+}
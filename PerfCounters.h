@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <optional>
+#include <string>
+
+namespace commentstripper {
+	/**
+	 * Hardware performance counters for the calling thread (and any threads it starts while counting), read via Linux's
+	 * perf_event_open(). Counters that can't be opened -- on other platforms, in containers without access to the PMU,
+	 * or when perf_event_paranoid forbids it -- are simply missing from the results.
+	 */
+	class PerfCounters {
+	public:
+		enum Event {
+			CYCLES,
+			INSTRUCTIONS,
+			BRANCH_MISSES,
+			L1D_READ_MISSES,
+			N_EVENTS
+		};
+
+		using Reading = std::array<std::optional<double>, N_EVENTS>;	// Scaled up if the kernel had to multiplex
+
+		PerfCounters();
+		~PerfCounters();
+		PerfCounters(const PerfCounters&) = delete;
+		PerfCounters& operator=(const PerfCounters&) = delete;
+
+		bool anyAvailable() const;
+		const std::string& unavailableReason() const;	// Why the first missing counter couldn't be opened
+
+		// Zeroes then enables every available counter.
+		void start();
+		void stop();
+		Reading read() const;
+
+		static const char* name(Event e);
+
+	private:
+		std::array<int, N_EVENTS> fds;
+		std::string reason;
+	};
+}
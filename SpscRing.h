@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+namespace commentstripper {
+	/**
+	 * A bounded, lock-free queue between exactly one producer thread and one consumer thread. push() and pop() wait
+	 * while the ring is full or empty, so a fast stage can never run more than Capacity items ahead of a slow one: first
+	 * yielding the CPU for a few tries, in case the other side is about to catch up, then sleeping until it does, so
+	 * that a stage stuck behind slow I/O costs no CPU time. Only a thread about to sleep takes the mutex, and the other
+	 * side takes it only to wake one.
+	 */
+	template <typename T, std::size_t Capacity>
+	class SpscRing {
+		static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+
+	public:
+		bool tryPush(const T& value) {
+			std::size_t t = tail.load(std::memory_order_relaxed);
+			if (t - head.load(std::memory_order_acquire) == Capacity) {
+				return false;
+			}
+
+			slots[t & (Capacity - 1)] = value;
+			tail.store(t + 1, std::memory_order_release);
+			return true;
+		}
+
+		bool tryPop(T& value) {
+			std::size_t h = head.load(std::memory_order_relaxed);
+			if (tail.load(std::memory_order_acquire) == h) {
+				return false;
+			}
+
+			value = slots[h & (Capacity - 1)];
+			head.store(h + 1, std::memory_order_release);
+			return true;
+		}
+
+		void push(const T& value) {
+			waitUntil([&] { return tryPush(value); });
+			wakeSleeper();
+		}
+
+		T pop() {
+			T value;
+			waitUntil([&] { return tryPop(value); });
+			wakeSleeper();
+			return value;
+		}
+
+	private:
+		static const int spinsBeforeSleeping = 64;
+
+		template <typename F>
+		void waitUntil(F done) {
+			for (int i = 0; i < spinsBeforeSleeping; ++i) {
+				if (done()) {
+					return;
+				}
+
+				std::this_thread::yield();
+			}
+
+			// Announce the sleeper before the last look at the ring, and wakeSleeper() looks for it after changing the
+			// ring, with a full fence on each side: so either that last look sees the change, or the change's wakeup
+			// sees the sleeper, and takes the mutex to wake it, which it can't do until the sleeper is waiting.
+			std::unique_lock<std::mutex> lock(m);
+			nSleeping.fetch_add(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			woken.wait(lock, done);
+			nSleeping.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		void wakeSleeper() {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (nSleeping.load(std::memory_order_relaxed) != 0) {
+				std::lock_guard<std::mutex> lock(m);
+				woken.notify_all();	// Both sides may briefly be waiting, one of them only to take the mutex back
+			}
+		}
+
+		std::array<T, Capacity> slots{};
+		alignas(64) std::atomic<std::size_t> head{ 0 };	// Next slot to pop. Only the consumer writes it
+		alignas(64) std::atomic<std::size_t> tail{ 0 };	// Next slot to push. Only the producer writes it
+		alignas(64) std::atomic<unsigned> nSleeping{ 0 };	// Threads in waitUntil() that gave up spinning
+		std::mutex m;
+		std::condition_variable woken;
+	};
+}
@@ -0,0 +1,326 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The comment-stripping state machine, expressed as a table of transitions computed at compile time. Each input
+// character is first mapped to one of a handful of byte classes; the current state, the backslashSeen bit and the
+// byte class then select the next state, the next backslashSeen bit and an action saying what to emit. Replaces a
+// nested switch statement, which was both harder to check for completeness and full of hard-to-predict branches.
+namespace commentstripper {
+	enum class State : unsigned char {
+		NORMAL,
+		IN_STRING,
+		IN_CHAR,
+		SLASH,
+		ASTERISK_IN_MULTILINE_COMMENT,
+		IN_SINGLE_LINE_COMMENT,
+		IN_MULTILINE_COMMENT,
+		CARRIAGE_RETURN_IN_SINGLE_LINE_COMMENT,	// Just read a CR, which is kept if an LF follows
+		RAW_STRING_DELIMITER,	// Between the '"' and '(' of R"delim(...)delim"
+		RAW_STRING
+	};
+
+	constexpr std::size_t nStates = 10;
+
+	constexpr const char* stateName(State s) {
+		switch (s) {
+		case State::NORMAL: return "NORMAL";
+		case State::IN_STRING: return "IN_STRING";
+		case State::IN_CHAR: return "IN_CHAR";
+		case State::SLASH: return "SLASH";
+		case State::ASTERISK_IN_MULTILINE_COMMENT: return "ASTERISK_IN_MULTILINE_COMMENT";
+		case State::IN_SINGLE_LINE_COMMENT: return "IN_SINGLE_LINE_COMMENT";
+		case State::IN_MULTILINE_COMMENT: return "IN_MULTILINE_COMMENT";
+		case State::CARRIAGE_RETURN_IN_SINGLE_LINE_COMMENT: return "CARRIAGE_RETURN_IN_SINGLE_LINE_COMMENT";
+		case State::RAW_STRING_DELIMITER: return "RAW_STRING_DELIMITER";
+		case State::RAW_STRING: return "RAW_STRING";
+		}
+
+		return "?";
+	}
+
+	constexpr bool isComment(State s) {
+		return s == State::IN_SINGLE_LINE_COMMENT || s == State::CARRIAGE_RETURN_IN_SINGLE_LINE_COMMENT ||
+			s == State::IN_MULTILINE_COMMENT || s == State::ASTERISK_IN_MULTILINE_COMMENT;
+	}
+
+	enum class ByteClass : unsigned char {
+		OTHER,
+		DOUBLE_QUOTE,
+		SINGLE_QUOTE,
+		BACKSLASH,
+		SLASH,
+		ASTERISK,
+		NEWLINE,
+		CARRIAGE_RETURN
+	};
+
+	constexpr std::size_t nByteClasses = 8;
+
+	enum class Action : unsigned char {
+		EMIT,				// Emit the character, preceded by its backslash-newline pairs
+		EMIT_PAIRS,			// Emit only the pairs: the character is a '/' that may begin a comment
+		EMIT_PENDING_SLASH,	// It didn't: emit the '/' held back in SLASH, then the pairs and the character
+		EMIT_NEWLINE,		// Emit a bare newline, dropping its pairs: the end of a single-line comment
+		EMIT_CRLF,			// Emit the CR held back at the end of a single-line comment, if right before, and the newline
+		EMIT_SPACE,			// Emit a space in place of a multiline comment, so "abc/*---*/def" still parses as 2 tokens
+		DROP				// Emit nothing
+	};
+
+	struct Transition {
+		State next;
+		bool backslashSeen;
+		Action action;
+	};
+
+	constexpr ByteClass classify(unsigned char c) {
+		switch (c) {
+		case '"': return ByteClass::DOUBLE_QUOTE;
+		case '\'': return ByteClass::SINGLE_QUOTE;
+		case '\\': return ByteClass::BACKSLASH;
+		case '/': return ByteClass::SLASH;
+		case '*': return ByteClass::ASTERISK;
+		case '\n': return ByteClass::NEWLINE;
+		case '\r': return ByteClass::CARRIAGE_RETURN;
+		default: return ByteClass::OTHER;
+		}
+	}
+
+	// The rules, one state at a time. Only ever evaluated by the compiler, to fill in transitionTable.
+	constexpr Transition transition(State s, bool backslashSeen, ByteClass c) {
+		// Outside single-line comments, where a CR may begin a CRLF line ending that is kept, a CR is like any other byte
+		bool inSingleLineComment = s == State::IN_SINGLE_LINE_COMMENT || s == State::CARRIAGE_RETURN_IN_SINGLE_LINE_COMMENT;
+		if (c == ByteClass::CARRIAGE_RETURN && !inSingleLineComment) {
+			c = ByteClass::OTHER;
+		}
+
+		switch (s) {
+		case State::NORMAL:
+			switch (c) {
+			case ByteClass::DOUBLE_QUOTE: return { State::IN_STRING, false, Action::EMIT };
+			case ByteClass::SINGLE_QUOTE: return { State::IN_CHAR, false, Action::EMIT };
+			case ByteClass::BACKSLASH: return { State::NORMAL, !backslashSeen, Action::EMIT };
+			case ByteClass::SLASH: return { State::SLASH, false, Action::EMIT_PAIRS };
+			default: return { State::NORMAL, false, Action::EMIT };
+			}
+
+		case State::IN_STRING:
+		case State::IN_CHAR: {
+			ByteClass closingQuote = (s == State::IN_STRING ? ByteClass::DOUBLE_QUOTE : ByteClass::SINGLE_QUOTE);
+			if (c == closingQuote || c == ByteClass::NEWLINE) {	// Newline before end of literal: Syntax error
+				return { backslashSeen ? s : State::NORMAL, false, Action::EMIT };
+			} else if (c == ByteClass::BACKSLASH) {
+				return { s, !backslashSeen, Action::EMIT };
+			} else {
+				return { s, false, Action::EMIT };
+			}
+		}
+
+		case State::SLASH:
+			switch (c) {
+			case ByteClass::SLASH: return { State::IN_SINGLE_LINE_COMMENT, backslashSeen, Action::DROP };
+			case ByteClass::ASTERISK: return { State::IN_MULTILINE_COMMENT, backslashSeen, Action::DROP };
+			case ByteClass::DOUBLE_QUOTE: return { State::IN_STRING, false, Action::EMIT_PENDING_SLASH };	// As in a/"x"
+			case ByteClass::SINGLE_QUOTE: return { State::IN_CHAR, false, Action::EMIT_PENDING_SLASH };
+			default: return { State::NORMAL, backslashSeen, Action::EMIT_PENDING_SLASH };
+			}
+
+		case State::IN_SINGLE_LINE_COMMENT:
+		case State::CARRIAGE_RETURN_IN_SINGLE_LINE_COMMENT:
+			switch (c) {
+			case ByteClass::NEWLINE:
+				return { State::NORMAL, backslashSeen, s == State::IN_SINGLE_LINE_COMMENT ? Action::EMIT_NEWLINE : Action::EMIT_CRLF };
+			case ByteClass::CARRIAGE_RETURN: return { State::CARRIAGE_RETURN_IN_SINGLE_LINE_COMMENT, backslashSeen, Action::DROP };
+			default: return { State::IN_SINGLE_LINE_COMMENT, backslashSeen, Action::DROP };
+			}
+
+		case State::IN_MULTILINE_COMMENT:
+			if (c == ByteClass::ASTERISK) {
+				return { State::ASTERISK_IN_MULTILINE_COMMENT, backslashSeen, Action::DROP };
+			}
+			return { s, backslashSeen, Action::DROP };
+
+		case State::ASTERISK_IN_MULTILINE_COMMENT:
+			switch (c) {
+			case ByteClass::SLASH: return { State::NORMAL, backslashSeen, Action::EMIT_SPACE };
+			case ByteClass::ASTERISK: return { s, backslashSeen, Action::DROP };
+			default: return { State::IN_MULTILINE_COMMENT, backslashSeen, Action::DROP };
+			}
+
+		// Where a raw string ends depends on its delimiter, which doesn't fit in a PackedState, so BasicStripper
+		// handles these states itself; the table only says that everything in them is kept.
+		case State::RAW_STRING_DELIMITER:
+		case State::RAW_STRING:
+			return { s, false, Action::EMIT };
+		}
+
+		return { s, backslashSeen, Action::DROP };	// Unreachable
+	}
+
+	// The state and backslashSeen bit packed into one small integer -- already multiplied by nByteClasses, so that it is
+	// the offset of its row in transitionTable. A transition is then a single add and load, whose result feeds
+	// straight into the next one.
+	using PackedState = unsigned char;
+
+	constexpr PackedState pack(State s, bool backslashSeen) {
+		return static_cast<PackedState>((static_cast<unsigned>(s) * 2 + backslashSeen) * nByteClasses);
+	}
+
+	constexpr State stateOf(PackedState p) {
+		return static_cast<State>(p / nByteClasses / 2);
+	}
+
+	constexpr bool backslashSeenOf(PackedState p) {
+		return p / nByteClasses % 2 != 0;
+	}
+
+	struct PackedTransition {
+		PackedState next;
+		Action action;
+	};
+
+	constexpr std::size_t nPackedStates = nStates * 2;
+
+	using TransitionTable = std::array<PackedTransition, nPackedStates * nByteClasses>;
+
+	constexpr TransitionTable makeTransitionTable() {
+		TransitionTable table{};
+		for (std::size_t s = 0; s < nStates; ++s) {
+			for (std::size_t b = 0; b < 2; ++b) {
+				for (std::size_t c = 0; c < nByteClasses; ++c) {
+					Transition t = transition(static_cast<State>(s), b != 0, static_cast<ByteClass>(c));
+					table[pack(static_cast<State>(s), b != 0) + c] = { pack(t.next, t.backslashSeen), t.action };
+				}
+			}
+		}
+
+		return table;
+	}
+
+	constexpr std::array<ByteClass, 256> makeByteClassTable() {
+		std::array<ByteClass, 256> table{};
+		for (std::size_t c = 0; c < 256; ++c) {
+			table[c] = classify(static_cast<unsigned char>(c));
+		}
+
+		return table;
+	}
+
+	inline constexpr TransitionTable transitionTable = makeTransitionTable();
+	inline constexpr std::array<ByteClass, 256> byteClassTable = makeByteClassTable();
+
+	/**
+	 * The backslash-newline pairs read before a character: how many, and which of them end in CR LF rather than just
+	 * LF. The first 64 endings are the bits of crlf (bit i for the i-th pair), which is plenty for real code; those of
+	 * any longer run are kept in later, as the lengths of alternating runs of LF and CR LF pairs, so that every pair is
+	 * still reproduced exactly. BasicStripper passes each run on as soon as it is read unless it follows a '/', so only
+	 * such a run can grow later for long.
+	 */
+	struct BackslashNewlines {
+		unsigned n = 0;
+		std::uint64_t crlf = 0;
+		std::vector<unsigned> later;	// LF first, so the first run may be empty
+
+		void add(bool isCrlf) {
+			if (n < 64) {
+				crlf |= static_cast<std::uint64_t>(isCrlf) << n;
+			} else if (!later.empty() && later.size() % 2 != isCrlf) {	// The last run ends the same way
+				++later.back();
+			} else {
+				if (later.empty() && isCrlf) {
+					later.push_back(0);
+				}
+				later.push_back(1);
+			}
+
+			++n;
+		}
+
+		// Calls f(isCrlf) for each pair in turn.
+		template <typename F>
+		void forEach(F&& f) const {
+			for (unsigned i = 0; i < n && i < 64; ++i) {
+				f((crlf >> i & 1) != 0);
+			}
+
+			for (std::size_t r = 0; r < later.size(); ++r) {
+				for (unsigned k = 0; k < later[r]; ++k) {
+					f(r % 2 == 1);
+				}
+			}
+		}
+
+		// How many input bytes they took up
+		std::uint64_t size() const {
+			std::uint64_t nCrlf = 0;
+			for (std::uint64_t bits = crlf; bits; bits &= bits - 1) {
+				++nCrlf;
+			}
+
+			for (std::size_t r = 1; r < later.size(); r += 2) {
+				nCrlf += later[r];
+			}
+
+			return 2 * static_cast<std::uint64_t>(n) + nCrlf;
+		}
+
+		bool operator==(const BackslashNewlines& rhs) const {
+			return n == rhs.n && crlf == rhs.crlf && later == rhs.later;
+		}
+	};
+
+	template <typename Out>
+	inline void putOnlyBackslashNewlinePairs(Out& out, const BackslashNewlines& pairs) {
+		if (pairs.n == 0) {	// The commonest case by far
+			return;
+		}
+
+		pairs.forEach([&](bool isCrlf) {
+			if (isCrlf) {
+				out.append("\\\r\n", 3);
+			} else {
+				out.append("\\\n", 2);
+			}
+		});
+	}
+
+	/**
+	 * Advances state over the character c, which was preceded by the backslash-newline pairs in pairs, appending
+	 * whatever should be kept to out (a std::string or anything else with push_back() and append()).
+	 */
+	template <typename Out>
+	inline void step(PackedState& state, const BackslashNewlines& pairs, char c, Out& out) {
+		PackedTransition t = transitionTable[state + static_cast<std::size_t>(byteClassTable[static_cast<unsigned char>(c)])];
+		state = t.next;
+
+		if (t.action == Action::EMIT && pairs.n == 0) {	// By far the commonest case
+			out.push_back(c);
+			return;
+		}
+
+		switch (t.action) {
+		case Action::EMIT_PENDING_SLASH:
+			out.push_back('/');
+			// Fall through
+		case Action::EMIT:
+			putOnlyBackslashNewlinePairs(out, pairs);
+			out.push_back(c);
+			break;
+
+		case Action::EMIT_PAIRS: putOnlyBackslashNewlinePairs(out, pairs); break;
+		case Action::EMIT_CRLF:
+			if (pairs.n == 0) {
+				out.push_back('\r');
+			}
+			out.push_back('\n');
+			break;
+
+		case Action::EMIT_NEWLINE: out.push_back('\n'); break;
+		case Action::EMIT_SPACE: out.push_back(' '); break;
+		case Action::DROP: break;
+		}
+	}
+}
@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <system_error>
+#include <vector>
+#include "CommentStripper.h"
+#include "StripCache.h"
+#include "Xxh64.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace commentstripper {
+	namespace {
+		const char* const tempPrefix = "tmp-";
+
+		void appendHex(string& s, uint64_t x) {
+			static const char digits[] = "0123456789abcdef";
+			for (int shift = 60; shift >= 0; shift -= 4) {
+				s.push_back(digits[(x >> shift) & 0xF]);
+			}
+		}
+
+		// Unique across threads and processes sharing the directory.
+		string tempName() {
+			static const uint64_t processNonce = (uint64_t(random_device()()) << 32) ^ random_device()();
+			static atomic<uint64_t> counter{ 0 };
+			string name = tempPrefix;
+			appendHex(name, processNonce);
+			name += '-';
+			name += to_string(counter++);
+			return name;
+		}
+
+		// Makes to share from's data blocks, if the file system can. Either way, to may have been created.
+		bool reflink(const fs::path& from, const fs::path& to) {
+#if defined(__linux__) && defined(FICLONE)
+			int fromFd = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fromFd < 0) {
+				return false;
+			}
+
+			bool cloned = false;
+			int toFd = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+			if (toFd >= 0) {
+				cloned = ioctl(toFd, FICLONE, fromFd) == 0;
+				cloned = (close(toFd) == 0) && cloned;
+			}
+
+			close(fromFd);
+			return cloned;
+#else
+			(void)from;
+			(void)to;
+			return false;
+#endif
+		}
+	}
+
+	StripCache::StripCache(fs::path directory, uintmax_t maxBytes) : directory(move(directory)), maxBytes(maxBytes) {}
+
+	string StripCache::key(string_view input, string_view variant) {
+		// 128 bits, as two 64-bit hashes with different seeds, so that collisions are not a concern in any real cache.
+		// The seeds depend on the version and variant
+		string rules = "StripCppComments " + to_string(stripperVersion) + ' ' + string(variant);
+		Xxh64 rulesHash;
+		rulesHash.append(rules.data(), rules.size());
+		uint64_t seed = rulesHash.digest();
+
+		string key;
+		for (uint64_t laneSeed : { seed, seed ^ uint64_t(0x9E3779B97F4A7C15ULL) }) {
+			Xxh64 hash(laneSeed);
+			hash.append(input.data(), input.size());
+			appendHex(key, hash.digest());
+		}
+
+		return key;
+	}
+
+	// Entries are spread over 256 subdirectories, as some file systems slow down with very many files in one directory.
+	fs::path StripCache::entryPath(const string& key) const {
+		return directory / key.substr(0, 2) / key.substr(2);
+	}
+
+	void StripCache::touch(const fs::path& entry) {
+		error_code ec;
+		fs::last_write_time(entry, fs::file_time_type::clock::now(), ec);
+	}
+
+	bool StripCache::fetch(const string& key, const fs::path& output) {
+		fs::path entry = entryPath(key);
+		error_code ec;
+		if (!reflink(entry, output)) {
+			fs::copy_file(entry, output, fs::copy_options::overwrite_existing, ec);
+		}
+
+		if (ec) {
+			++missCount;
+			return false;
+		}
+
+		touch(entry);
+		++hitCount;
+		return true;
+	}
+
+	bool StripCache::fetch(const string& key, string& out) {
+		fs::path entry = entryPath(key);
+		ifstream is(entry, ios::binary);
+		size_t oldSize = out.size();
+		char buffer[64 * 1024];
+		while (is && (is.read(buffer, sizeof buffer) || is.gcount())) {
+			out.append(buffer, static_cast<size_t>(is.gcount()));
+		}
+
+		if (!is.eof() || is.bad()) {	// Missing, or unreadable
+			out.resize(oldSize);
+			++missCount;
+			return false;
+		}
+
+		touch(entry);
+		++hitCount;
+		return true;
+	}
+
+	void StripCache::insert(const string& key, string_view output) {
+		fs::path entry = entryPath(key);
+		error_code ec;
+		fs::create_directories(entry.parent_path(), ec);
+		fs::path temp = directory / tempName();
+		ofstream os(temp, ios::binary);
+		os.write(output.data(), static_cast<streamsize>(output.size()));
+		os.close();
+		if (os) {
+			fs::rename(temp, entry, ec);	// Atomic, and replaces any entry another process inserted meanwhile
+		}
+
+		if (!os || ec) {
+			fs::remove(temp, ec);
+		} else {
+			++nInserted;
+		}
+	}
+
+	void StripCache::evict() {
+		if (!nInserted.exchange(0)) {
+			return;
+		}
+
+		struct Entry {
+			fs::file_time_type lastUsed;
+			uintmax_t size;
+			fs::path path;
+		};
+
+		vector<Entry> entries;
+		uintmax_t totalSize = 0;
+		auto staleTempTime = fs::file_time_type::clock::now() - chrono::hours(1);
+		error_code ec;
+		for (fs::recursive_directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec)) {
+			error_code entryEc;	// Other processes may delete files as we go; skip those
+			if (!it->is_regular_file(entryEc)) {
+				continue;
+			}
+
+			fs::file_time_type lastUsed = it->last_write_time(entryEc);
+			uintmax_t size = it->file_size(entryEc);
+			if (entryEc) {
+				continue;
+			}
+
+			if (it.depth() == 0) {
+				if (it->path().filename().string().rfind(tempPrefix, 0) == 0 && lastUsed < staleTempTime) {
+					fs::remove(it->path(), entryEc);
+				}
+			} else {
+				entries.push_back({ lastUsed, size, it->path() });
+				totalSize += size;
+			}
+		}
+
+		sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.lastUsed < b.lastUsed; });
+		for (auto entry = entries.begin(); totalSize > maxBytes && entry != entries.end(); ++entry) {
+			fs::remove(entry->path, ec);
+			totalSize -= entry->size;
+		}
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+namespace commentstripper {
+	/**
+	 * A directory of stripped outputs, keyed by a hash of the input bytes and of how they are stripped, so that unchanged
+	 * inputs needn't be stripped again. Any number of threads and processes may share one directory: entries are written
+	 * to a temporary file and renamed into place, so readers only ever see complete entries, and a reader racing with
+	 * eviction just sees a miss.
+	 *
+	 * Least recently used entries are evicted by evict() once the directory holds more than maxBytes. Use is tracked by
+	 * modification time, which fetch() updates on every hit, since access times are often not maintained.
+	 */
+	class StripCache {
+	public:
+		StripCache(std::filesystem::path directory, std::uintmax_t maxBytes);
+
+		/**
+		 * The key for stripping input. variant must distinguish any options that change the output; the stripper version
+		 * is always included.
+		 */
+		static std::string key(std::string_view input, std::string_view variant = {});
+
+		/**
+		 * On a hit, makes output a copy of the entry for key -- a reflink where the file system supports them, so no data
+		 * is copied -- and returns true. Returns false on a miss. output's directory must exist.
+		 */
+		bool fetch(const std::string& key, const std::filesystem::path& output);
+
+		/**
+		 * On a hit, appends the entry for key to out and returns true. Returns false on a miss.
+		 */
+		bool fetch(const std::string& key, std::string& out);
+
+		/**
+		 * Adds output as the entry for key. Failure to write to the cache is not an error: the entry is just missing.
+		 */
+		void insert(const std::string& key, std::string_view output);
+
+		/**
+		 * If inserts may have taken the directory over maxBytes, deletes least recently used entries until it isn't.
+		 * Also deletes temporary files left behind by processes that died mid-insert.
+		 */
+		void evict();
+
+		std::uint64_t nHits() const {
+			return hitCount;
+		}
+
+		std::uint64_t nMisses() const {
+			return missCount;
+		}
+
+	private:
+		std::filesystem::path entryPath(const std::string& key) const;
+		void touch(const std::filesystem::path& entry);
+
+		std::filesystem::path directory;
+		std::uintmax_t maxBytes;
+		std::atomic<std::uint64_t> hitCount{ 0 };
+		std::atomic<std::uint64_t> missCount{ 0 };
+		std::atomic<std::uint64_t> nInserted{ 0 };
+	};
+}
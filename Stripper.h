@@ -0,0 +1,615 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include "ByteScanner.h"
+#include "StateMachine.h"
+
+// The resumable stripping loop behind every stripComments() overload and the CommentStripper class. Input may arrive
+// in pieces of any size, split anywhere, and no input is buffered between them. The state is a few dozen bytes, except
+// that line continuations right after a '/' are held until the next byte says whether they are in a comment: a run of
+// them costs one word per change between LF and CR LF endings after its first 64 (see BackslashNewlines).
+namespace commentstripper {
+	// Line continuation with <backslash><newline> complicates parsing, since any number of these pairs can appear even in the
+	// middle of a "//" single-line comment marker ("|" chars below just show the "page boundary"):
+	//
+	// |// Ordinary single-line comment                                  |
+	// |                                                                 |
+	// |/\                                                               |
+	// |/ Single-line comment with comment marker split over 2 lines!    |
+	// |int some_code;   /\                                              |
+	// |\                                                                |
+	// |\                                                                |
+	// |/ Another single\                                                |
+	// | line com\                                                       |
+	// |ment!                                                            |
+	// |float more_code;                                                 |
+	//
+	// Another quirk is that these pairs are parsed at a different level than the backslashes used in string and character
+	// literals, so, e.g.:
+	//
+	// |cout << "Line with one backslash\                                |
+	// |x41<--there." << endl;                                           |
+	// |cout << "Line with two backslashes\\                             |
+	// |x41<--there." << endl;                                           |
+	// |cout << "Line with three backslashes\\\                          |
+	// |x41<--there." << endl;                                           |
+	//
+	// produces:
+	//
+	// |Line with one backslashx41<--there.                              |
+	// |Line with two backslashesA<--there.                              |
+	// |Line with three backslashes\x41<--there.                         |
+	//
+	// (Note in particular that the final backslash on the line ending with two backslashes retains its line-continuing
+	// power, and the escape sequence begun by its first backslash continues on the second line, resulting in "\x41" == "A".)
+	//
+	// To reproduce all these <backslash><newline> pairs in the output without buffering the input, we treat the input not as
+	// a sequence of characters but as a sequence of (backslash-newline pairs, char) pairs, with no backslash-newline pairs
+	// before the char most of the time.
+	//
+	// A pair's newline may also be a CR LF, as in files with Windows line endings: CR bytes are kept exactly as they are,
+	// so the pairs remember which of them had one (see BackslashNewlines).
+	//
+	// The reader is fed raw bytes a block at a time and carries a pending backslash (and CR) and the pairs so far across
+	// block boundaries, so a block may end anywhere -- even between the backslash, CR and newline of a pair.
+	class BackslashNewlineReader {
+	public:
+		BackslashNewlineReader() : pending(Pending::NOTHING) {}
+
+		// Calls onPair(pairs, c) for every complete (pairs, char) pair in [p, end).
+		template <typename OnPair>
+		void feed(const char* p, const char* end, OnPair&& onPair) {
+			for (; p != end; ++p) {
+				char c = *p;
+
+				if (pending == Pending::BACKSLASH) {
+					pending = Pending::NOTHING;
+
+					if (c == '\n') {
+						pairs.add(false);
+						continue;
+					}
+
+					if (c == '\r') {
+						pending = Pending::BACKSLASH_CARRIAGE_RETURN;
+						continue;
+					}
+
+					emit('\\', onPair);
+				} else if (pending == Pending::BACKSLASH_CARRIAGE_RETURN) {
+					pending = Pending::NOTHING;
+
+					if (c == '\n') {
+						pairs.add(true);
+						continue;
+					}
+
+					emit('\\', onPair);
+					emit('\r', onPair);
+				}
+
+				if (c == '\\') {
+					pending = Pending::BACKSLASH;
+				} else {
+					emit(c, onPair);
+				}
+			}
+		}
+
+		// Is a backslash (and maybe a CR) waiting to learn whether it begins a backslash-newline pair?
+		bool backslashPending() const {
+			return pending != Pending::NOTHING;
+		}
+
+		// Have pairs been read that no character has followed yet?
+		bool anyPendingPairs() const {
+			return pairs.n != 0;
+		}
+
+		// Hands over the pairs read so far, for a caller that consumes the following characters itself.
+		BackslashNewlines takePendingPairs() {
+			if (pairs.n == 0) {	// The commonest case by far, and cheaper than moving an empty vector about
+				return BackslashNewlines();
+			}
+
+			return std::exchange(pairs, BackslashNewlines());
+		}
+
+		// Flushes a trailing backslash (and CR) at end of input, and returns the pairs left dangling after it.
+		template <typename OnPair>
+		BackslashNewlines finish(OnPair&& onPair) {
+			if (pending != Pending::NOTHING) {
+				emit('\\', onPair);
+				if (pending == Pending::BACKSLASH_CARRIAGE_RETURN) {
+					emit('\r', onPair);
+				}
+
+				pending = Pending::NOTHING;
+			}
+
+			return takePendingPairs();
+		}
+
+		bool operator==(const BackslashNewlineReader& rhs) const {
+			return pending == rhs.pending && pairs == rhs.pairs;
+		}
+
+	private:
+		enum class Pending : unsigned char {
+			NOTHING,
+			BACKSLASH,
+			BACKSLASH_CARRIAGE_RETURN
+		};
+
+		template <typename OnPair>
+		void emit(char c, OnPair& onPair) {
+			onPair(takePendingPairs(), c);
+		}
+
+		Pending pending;
+		BackslashNewlines pairs;
+	};
+
+	// Raw string literals, like R"delim(...)delim", end only at a ')', their delimiter and a '"', so neither quotes,
+	// backslashes nor comment markers inside them mean anything. Backslash-newline pairs inside them are kept as
+	// written, not spliced, so also break up a closing sequence. The delimiter is at most 16 characters, and once it
+	// has been read, the closing sequence can be matched a byte at a time: its only ')' is its first byte, so after a
+	// mismatch the match restarts at that byte or not at all. So there is still no lookahead, and the bytes held are
+	// bounded.
+	//
+	// Whether a '"' opens one depends on the identifier just before it: exactly R, uR, UR, LR or u8R. Only a '"' in
+	// NORMAL needs to know, so the bytes before it are looked at then, where they are still in the input; what is kept
+	// is just the last few identifier bytes from before that input, updated at its end from its last 4 bytes alone.
+	class RawStringScanner {
+	public:
+		static constexpr std::size_t maxDelimiterLength = 16;
+
+		RawStringScanner() : identifierTail(0), delimiterLength(0), nMatched(0), delimiter() {}
+
+		// Records that c, or [p, end), was read.
+		void note(char c) {
+			identifierTail = shiftIn(identifierTail, c);
+		}
+
+		void note(const char* p, const char* end) {
+			identifierTail = tailAfter(identifierTail, p, end);
+		}
+
+		// Would a '"' read now, or after [p, end), open a raw string?
+		bool prefixes() const {
+			return isPrefix(identifierTail);
+		}
+
+		bool prefixes(const char* p, const char* end) const {
+			return isPrefix(tailAfter(identifierTail, p, end));
+		}
+
+		// Appends c to the delimiter, returning false if it is not allowed there.
+		bool extendDelimiter(char c) {
+			// Any printable character but space, parentheses and backslash
+			if (c <= ' ' || c > '~' || c == '(' || c == ')' || c == '\\' || delimiterLength == maxDelimiterLength) {
+				return false;
+			}
+
+			delimiter[delimiterLength++] = c;
+			return true;
+		}
+
+		// Is part of the closing sequence waiting to be matched by the next byte?
+		bool matching() const {
+			return nMatched != 0;
+		}
+
+		// Backslash-newline pairs were read, breaking up any closing sequence being matched.
+		void interrupt() {
+			nMatched = 0;
+		}
+
+		// Advances the closing sequence over c, preceded by the backslash-newline pairs in pairs. Returns true if c is
+		// its final '"'.
+		bool closesAt(const BackslashNewlines& pairs, char c) {
+			if (pairs.n == 0 && nMatched != 0) {
+				if (nMatched <= delimiterLength && c == delimiter[nMatched - 1]) {
+					++nMatched;
+					return false;
+				}
+
+				if (nMatched == delimiterLength + 1 && c == '"') {
+					end();
+					return true;
+				}
+			}
+
+			nMatched = (c == ')');
+			return false;
+		}
+
+		// Forgets the delimiter, on leaving a raw string.
+		void end() {
+			delimiterLength = 0;
+			nMatched = 0;
+		}
+
+		bool operator==(const RawStringScanner& rhs) const {
+			return identifierTail == rhs.identifierTail && delimiterLength == rhs.delimiterLength && nMatched == rhs.nMatched &&
+				std::equal(delimiter, delimiter + delimiterLength, rhs.delimiter);
+		}
+
+	private:
+		static std::uint32_t shiftIn(std::uint32_t tail, char c) {
+			unsigned char u = static_cast<unsigned char>(c);
+			bool identifier = (u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z') || (u >= '0' && u <= '9') || u == '_' ||
+				u == '$' || u >= 0x80;
+			return identifier ? (tail << 8 | u) : 0;
+		}
+
+		static std::uint32_t tailAfter(std::uint32_t tail, const char* p, const char* end) {
+			for (p = end - std::min<std::ptrdiff_t>(end - p, 4); p != end; ++p) {
+				tail = shiftIn(tail, *p);
+			}
+
+			return tail;
+		}
+
+		// Identifiers longer than 3 bytes leave a nonzero top byte, so match none of these
+		static bool isPrefix(std::uint32_t tail) {
+			return tail == 'R' || tail == ('u' << 8 | 'R') || tail == ('U' << 8 | 'R') || tail == ('L' << 8 | 'R') ||
+				tail == ('u' << 16 | '8' << 8 | 'R');
+		}
+
+		std::uint32_t identifierTail;	// The last up to 4 identifier bytes read, 0 after any other byte
+		unsigned char delimiterLength;
+		unsigned char nMatched;			// Bytes of ")delimiter\"" matched so far
+		char delimiter[maxDelimiterLength];
+	};
+
+	// The default stats policy for BasicStripper: hooks that compile away to nothing. Besides counting, a policy is shown
+	// the text of each comment as it is dropped: after countComment(), the comment's input bytes in order, from its
+	// first '/', through commentText() -- backslash-newline pairs, then bytes read after them -- then commentEnded().
+	struct NoStats {
+		void countBytes(State, std::uint64_t) {}
+		void countPairs(unsigned) {}
+		void countComment() {}
+		void commentText(const BackslashNewlines&, const char*, std::size_t) {}
+		void commentEnded() {}
+	};
+
+	// The default options policy for BasicStripper: comments are dropped, leaving only the newline that ends a single-line
+	// comment and the space in place of a multiline one. A policy is shown each comment's text just as a stats policy
+	// is, except that replace() comes before whatever the step reading it outputs, and may append a replacement to out.
+	// spaceAfterComment() says, as a multiline comment's closing '/' is about to be read, whether it still needs a
+	// space in its place.
+	struct DropComments {
+		template <typename Out>
+		void replace(const BackslashNewlines&, const char*, std::size_t, Out&) {}
+		void commentEnded() {}
+		bool spaceAfterComment() const { return true; }
+		bool operator==(const DropComments&) const { return true; }
+	};
+
+	// All the state needed to strip comments from input that arrives in arbitrary-sized pieces, appending to out (an
+	// OutputSink, a std::string or anything else with push_back() and append()). Stats and Options are both chosen at
+	// compile time, so each combination gets its own loop, with nothing checked per byte that it doesn't need.
+	template <typename Stats, typename Options = DropComments>
+	class BasicStripper {
+	public:
+		explicit BasicStripper(PackedState initial = pack(State::NORMAL, false), Stats stats = Stats(), Options options = Options()) :
+			state(initial), stats(stats), options(options) {}
+
+		// Backslash-newline pairs are rare in real code, so first find the next one with a vectorised search, and run
+		// everything before it through the state machine as plain bytes. Only the pair itself (or a backslash ending
+		// the block, which might begin one) goes through the reader's (count, char) decomposition.
+		template <typename Out>
+		void feed(const char* p, const char* end, Out& out) {
+			auto onPair = [&](const BackslashNewlines& pairs, char c) { stepAnywhere(pairs, c, out); };
+
+			while (p != end) {
+				if (!reader.backslashPending()) {
+					const char* plainEnd = findBackslashNewline(p, end);
+					feedPlain(p, plainEnd, out);
+					p = plainEnd;
+					if (p == end) {
+						break;
+					}
+				}
+
+				reader.feed(p, p + 1, onPair);
+				++p;
+				if (reader.anyPendingPairs() && stateOf(state) != State::SLASH) {
+					passOnPairs(out);
+				}
+			}
+		}
+
+		template <typename Out>
+		void finish(Out& out) {
+			BackslashNewlines pairs = reader.finish([&](const BackslashNewlines& p, char c) { stepAnywhere(p, c, out); });
+			stats.countBytes(stateOf(state), pairs.size());
+			stats.countPairs(pairs.n);
+
+			// The held-back '/' came before any pairs still dangling
+			if (stateOf(state) == State::SLASH) {
+				out.push_back('/');
+			} else if (stateOf(state) == State::CARRIAGE_RETURN_IN_SINGLE_LINE_COMMENT) {
+				options.replace(BackslashNewlines(), "\r", 1, out);
+				stats.commentText(BackslashNewlines(), "\r", 1);
+			}
+
+			if (isComment(stateOf(state))) {
+				options.commentEnded();
+				stats.commentEnded();
+			}
+
+			putOnlyBackslashNewlinePairs(out, pairs);
+
+			state = pack(State::NORMAL, false);
+			raw = RawStringScanner();
+		}
+
+		// The state the input read so far leaves it in. Output appended by a step comes after the step's change of
+		// state, so a sink can ask this to learn what it is being given: e.g., the '"' opening a string arrives in
+		// IN_STRING, but the one closing it in NORMAL.
+		State currentState() const {
+			return stateOf(state);
+		}
+
+		// Two strippers in the same state will produce the same output from here on, whatever came before.
+		bool operator==(const BasicStripper& rhs) const {
+			return state == rhs.state && reader == rhs.reader && raw == rhs.raw && options == rhs.options;
+		}
+
+	private:
+		// Shows options the text of comments, as showCommentText() shows stats, along with where to put replacements.
+		template <typename Out>
+		struct Replacing {
+			Options& options;
+			Out& out;
+
+			void countComment() {}
+			void commentText(const BackslashNewlines& pairs, const char* p, std::size_t n) { options.replace(pairs, p, n, out); }
+			void commentEnded() { options.commentEnded(); }
+		};
+
+		// Feeds [p, end), which contains no backslash-newline pairs, and does not end with a backslash.
+		template <typename Out>
+		void feedPlain(const char* p, const char* end, Out& out) {
+			const char* begin = p;
+			while (p != end) {
+				p = skipOrdinaryRun(begin, p, end, out);
+				if (p == end) {
+					break;
+				}
+
+				step(reader.takePendingPairs(), *p, out);
+				++p;
+			}
+
+			raw.note(begin, end);
+		}
+
+		// Most bytes cannot change the state they are read in: e.g., in NORMAL, only '"', '\'' and '/' can. Find the next
+		// byte that can with a vectorised search, and copy or drop everything before it in bulk. Returns a pointer to
+		// that next byte. (In NORMAL, backslashSeen is always reset before it is next consulted, so backslashes there
+		// need no special treatment; in comments, only backslash-newline pairs matter, and [p, end) has none.) The bytes
+		// from begin to p were fed before p; they say whether a '"' in NORMAL opens a raw string.
+		template <typename Out>
+		const char* skipOrdinaryRun(const char* begin, const char* p, const char* end, Out& out) {
+			const char* q;
+			bool keep = true;
+			bool opensRawString = false;
+
+			switch (stateOf(state)) {
+			case State::NORMAL:
+				q = findFirstOf(p, end, '"', '\'', '/', '/');
+				opensRawString = (q != end && *q == '"' && raw.prefixes(begin, q));
+				break;
+
+			case State::IN_STRING: q = findFirstOf(p, end, '"', '\\', '\n', '\n'); break;
+			case State::IN_CHAR: q = findFirstOf(p, end, '\'', '\\', '\n', '\n'); break;
+			case State::IN_SINGLE_LINE_COMMENT: q = findFirstOf(p, end, '\n', '\r', '\n', '\n'); keep = false; break;
+			case State::IN_MULTILINE_COMMENT: q = findFirstOf(p, end, '*', '*', '*', '*'); keep = false; break;
+			case State::RAW_STRING_DELIMITER:
+			case State::RAW_STRING: return skipRawString(p, end, out);
+			default: return p;	// Other states are usually left after a single byte
+			}
+
+			if (q != p) {
+				BackslashNewlines pairs = reader.takePendingPairs();
+				stats.countBytes(stateOf(state), (q - p) + pairs.size());
+				stats.countPairs(pairs.n);
+				if (keep) {
+					putOnlyBackslashNewlinePairs(out, pairs);
+					out.append(p, q - p);
+					state = pack(stateOf(state), false);
+				} else {
+					options.replace(pairs, p, q - p, out);
+					stats.commentText(pairs, p, q - p);
+				}
+			}
+
+			return opensRawString ? openRawString(q, end, out) : q;
+		}
+
+		// Reads the '"' at p that opens a raw string, then as much of the raw string as [p, end) holds.
+		template <typename Out>
+		const char* openRawString(const char* p, const char* end, Out& out) {
+			step(reader.takePendingPairs(), *p, out);
+			state = pack(State::RAW_STRING_DELIMITER, false);
+			return skipRawString(p + 1, end, out);
+		}
+
+		// Reads [p, end) up to the end of the raw string being read, copying everything. Returns a pointer to the byte
+		// after it.
+		template <typename Out>
+		const char* skipRawString(const char* p, const char* end, Out& out) {
+			while (p != end && stateOf(state) >= State::RAW_STRING_DELIMITER) {
+				if (stateOf(state) == State::RAW_STRING && !raw.matching()) {
+					const char* q = findFirstOf(p, end, ')', ')', ')', ')');
+					if (q != p) {
+						BackslashNewlines pairs = reader.takePendingPairs();
+						stats.countBytes(State::RAW_STRING, (q - p) + pairs.size());
+						stats.countPairs(pairs.n);
+						putOnlyBackslashNewlinePairs(out, pairs);
+						out.append(p, q - p);
+						p = q;
+						if (p == end) {
+							break;
+						}
+					}
+				}
+
+				stepRaw(reader.takePendingPairs(), *p, out);
+				++p;
+			}
+
+			return p;
+		}
+
+		template <typename Out>
+		void step(const BackslashNewlines& pairs, char c, Out& out) {
+			State before = stateOf(state);
+			stats.countBytes(before, 1 + pairs.size());
+			stats.countPairs(pairs.n);
+
+			// A replacement goes where the comment text was, so before anything the step outputs
+			PackedState next = transitionTable[state + static_cast<std::size_t>(byteClassTable[static_cast<unsigned char>(c)])].next;
+			bool spaced = options.spaceAfterComment();
+			Replacing<Out> replacing{ options, out };
+			showCommentText(replacing, before, stateOf(next), pairs, c);
+
+			if (before == State::ASTERISK_IN_MULTILINE_COMMENT && stateOf(next) == State::NORMAL && !spaced) {
+				state = next;
+			} else {
+				commentstripper::step(state, pairs, c, out);
+			}
+
+			showCommentText(stats, before, stateOf(state), pairs, c);
+		}
+
+		// Shows to (stats, or options) the part of a comment, if any, that a step from before to after reads. Nothing
+		// here has any effect unless the policy does something with comments.
+		template <typename To>
+		static void showCommentText(To& to, State before, State after, const BackslashNewlines& pairs, char c) {
+			switch (before) {
+			case State::SLASH:
+				if (isComment(after)) {
+					to.countComment();
+					to.commentText(BackslashNewlines(), "/", 1);
+					to.commentText(pairs, &c, 1);
+				}
+				return;
+
+			case State::CARRIAGE_RETURN_IN_SINGLE_LINE_COMMENT:
+				// The CR held back belongs to the comment unless it was kept, with the newline directly after it
+				if (after != State::NORMAL || pairs.n != 0) {
+					to.commentText(BackslashNewlines(), "\r", 1);
+				}
+				// Fall through
+			case State::IN_SINGLE_LINE_COMMENT:
+				// Neither the newline ending the comment nor a CR that may begin a CR LF doing so is part of it
+				to.commentText(pairs, &c, after == State::IN_SINGLE_LINE_COMMENT);
+				break;
+
+			case State::IN_MULTILINE_COMMENT:
+			case State::ASTERISK_IN_MULTILINE_COMMENT:
+				to.commentText(pairs, &c, 1);
+				break;
+
+			default: return;
+			}
+
+			if (after == State::NORMAL) {
+				to.commentEnded();
+			}
+		}
+
+		// Outputs, drops or replaces the backslash-newline pairs just read, without waiting for the byte after them: in
+		// every state but SLASH, that byte can't change what becomes of them. So pairs pile up only after a '/', where
+		// a '/' or '*' next would make them part of a comment.
+		template <typename Out>
+		void passOnPairs(Out& out) {
+			BackslashNewlines pairs = reader.takePendingPairs();
+			State s = stateOf(state);
+			stats.countBytes(s, pairs.size());
+			stats.countPairs(pairs.n);
+			switch (s) {
+			case State::RAW_STRING_DELIMITER:	// Not a raw string after all: carry on as if it were an ordinary one
+				raw.end();
+				state = pack(State::IN_STRING, false);
+				break;
+
+			case State::RAW_STRING:
+				raw.interrupt();
+				break;
+
+			case State::CARRIAGE_RETURN_IN_SINGLE_LINE_COMMENT:
+				// No newline directly after the CR held back, so it belongs to the comment
+				options.replace(BackslashNewlines(), "\r", 1, out);
+				stats.commentText(BackslashNewlines(), "\r", 1);
+				state = pack(State::IN_SINGLE_LINE_COMMENT, backslashSeenOf(state));
+				// Fall through
+			case State::IN_SINGLE_LINE_COMMENT:
+			case State::IN_MULTILINE_COMMENT:
+			case State::ASTERISK_IN_MULTILINE_COMMENT:
+				options.replace(pairs, "", 0, out);
+				stats.commentText(pairs, "", 0);
+				return;
+
+			default: break;
+			}
+
+			putOnlyBackslashNewlinePairs(out, pairs);
+		}
+
+		// As step(), but in any state, for a byte that the reader hands over: one after backslash-newline pairs, or a
+		// backslash that begins none.
+		template <typename Out>
+		void stepAnywhere(const BackslashNewlines& pairs, char c, Out& out) {
+			if (stateOf(state) >= State::RAW_STRING_DELIMITER) {
+				stepRaw(pairs, c, out);
+			} else if (c == '"' && stateOf(state) == State::NORMAL && raw.prefixes()) {
+				step(pairs, c, out);
+				state = pack(State::RAW_STRING_DELIMITER, false);
+			} else {
+				step(pairs, c, out);
+			}
+
+			raw.note(c);
+		}
+
+		// The transition table only knows that raw strings keep everything; where they end is decided here.
+		template <typename Out>
+		void stepRaw(const BackslashNewlines& pairs, char c, Out& out) {
+			State before = stateOf(state);
+			stats.countBytes(before, 1 + pairs.size());
+			stats.countPairs(pairs.n);
+			if (before == State::RAW_STRING_DELIMITER) {
+				if (pairs.n == 0 && c == '(') {
+					state = pack(State::RAW_STRING, false);
+				} else if (pairs.n != 0 || !raw.extendDelimiter(c)) {
+					// Not a raw string after all: carry on as if it were an ordinary one
+					raw.end();
+					state = pack(State::IN_STRING, false);
+					commentstripper::step(state, pairs, c, out);
+					return;
+				}
+			} else if (raw.closesAt(pairs, c)) {
+				state = pack(State::NORMAL, false);
+			}
+
+			putOnlyBackslashNewlinePairs(out, pairs);
+			out.push_back(c);
+		}
+
+		PackedState state;
+		BackslashNewlineReader reader;
+		RawStringScanner raw;
+		Stats stats;
+		Options options;
+	};
+
+	using Stripper = BasicStripper<NoStats>;
+}
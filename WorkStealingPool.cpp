@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "WorkStealingPool.h"
+
+using namespace std;
+
+namespace commentstripper {
+	namespace {
+		class TaskQueue {
+		public:
+			bool popFront(function<void()>& task) {
+				lock_guard<mutex> lock(m);
+				if (tasks.empty()) {
+					return false;
+				}
+
+				task = move(tasks.front());
+				tasks.pop_front();
+				return true;
+			}
+
+			bool stealBack(function<void()>& task) {
+				lock_guard<mutex> lock(m);
+				if (tasks.empty()) {
+					return false;
+				}
+
+				task = move(tasks.back());
+				tasks.pop_back();
+				return true;
+			}
+
+			void pushBack(function<void()> task) {
+				tasks.push_back(move(task));	// Only called before any worker starts
+			}
+
+		private:
+			mutex m;
+			deque<function<void()>> tasks;
+		};
+	}
+
+	WorkStealingPool::WorkStealingPool(unsigned nThreads) : nThreads(nThreads ? nThreads : 1) {}
+
+	void WorkStealingPool::run(vector<function<void()>> tasks) {
+		// A thread beyond one per task would find nothing to do
+		const unsigned nWorkers = static_cast<unsigned>(max<size_t>(min<size_t>(nThreads, tasks.size()), 1));
+		vector<TaskQueue> queues(nWorkers);
+		for (size_t i = 0; i < tasks.size(); ++i) {
+			queues[i % nWorkers].pushBack(move(tasks[i]));
+		}
+
+		// No tasks are ever added once workers start, so a worker that finds every queue empty can simply stop
+		auto worker = [&](unsigned self) {
+			function<void()> task;
+			while (true) {
+				bool found = queues[self].popFront(task);
+				for (unsigned i = 1; !found && i < nWorkers; ++i) {
+					found = queues[(self + i) % nWorkers].stealBack(task);
+				}
+
+				if (!found) {
+					return;
+				}
+
+				task();
+			}
+		};
+
+		vector<thread> threads;
+		try {
+			for (unsigned t = 1; t < nWorkers; ++t) {
+				threads.emplace_back(worker, t);
+			}
+		} catch (...) {
+			// Destroying a thread still running would terminate the program
+			for (auto& t : threads) {
+				t.join();
+			}
+			throw;
+		}
+
+		worker(0);
+		for (auto& t : threads) {
+			t.join();
+		}
+	}
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+namespace commentstripper {
+	/**
+	 * Runs a batch of independent tasks on a fixed number of threads. Task i starts out in worker (i % nThreads)'s
+	 * queue; each worker takes tasks from the front of its own queue, and when that is empty, steals from the back of
+	 * another's. So if tasks are given in decreasing order of cost, every worker starts on an expensive task, and the
+	 * cheap ones at the end fill in the gaps.
+	 */
+	class WorkStealingPool {
+	public:
+		explicit WorkStealingPool(unsigned nThreads);
+
+		// Runs every task exactly once, returning when all have finished, on no more threads than there are tasks. Tasks
+		// must not throw. If a thread can't be started, throws std::system_error once those that were have finished.
+		void run(std::vector<std::function<void()>> tasks);
+
+	private:
+		unsigned nThreads;
+	};
+}
@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <cstring>
+#include "Xxh64.h"
+
+using namespace std;
+
+// Follows the reference description at https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md. Input words
+// are read little-endian, which is what every platform we build on is.
+namespace commentstripper {
+	namespace {
+		const uint64_t prime1 = 11400714785074694791ULL;
+		const uint64_t prime2 = 14029467366897019727ULL;
+		const uint64_t prime3 = 1609587929392839161ULL;
+		const uint64_t prime4 = 9650029242287828579ULL;
+		const uint64_t prime5 = 2870177450012600261ULL;
+
+		uint64_t rotl(uint64_t x, int r) {
+			return (x << r) | (x >> (64 - r));
+		}
+
+		uint64_t read64(const unsigned char* p) {
+			uint64_t x;
+			memcpy(&x, p, sizeof x);
+			return x;
+		}
+
+		uint32_t read32(const unsigned char* p) {
+			uint32_t x;
+			memcpy(&x, p, sizeof x);
+			return x;
+		}
+
+		uint64_t round(uint64_t acc, uint64_t input) {
+			return rotl(acc + input * prime2, 31) * prime1;
+		}
+
+		uint64_t mergeRound(uint64_t acc, uint64_t value) {
+			return (acc ^ round(0, value)) * prime1 + prime4;
+		}
+	}
+
+	Xxh64::Xxh64(uint64_t seed) : seed(seed), acc{ seed + prime1 + prime2, seed + prime2, seed, seed - prime1 } {}
+
+	void Xxh64::consumeStripe(const unsigned char* p) {
+		for (int i = 0; i < 4; ++i) {
+			acc[i] = round(acc[i], read64(p + 8 * i));
+		}
+
+		nConsumed += stripeSize;
+	}
+
+	void Xxh64::append(const char* data, size_t n) {
+		auto* p = reinterpret_cast<const unsigned char*>(data);
+		if (nBuffered) {
+			size_t nCopied = min(n, stripeSize - nBuffered);
+			memcpy(buffer + nBuffered, p, nCopied);
+			nBuffered += nCopied;
+			p += nCopied;
+			n -= nCopied;
+			if (nBuffered < stripeSize) {
+				return;
+			}
+
+			consumeStripe(buffer);
+			nBuffered = 0;
+		}
+
+		for (; n >= stripeSize; p += stripeSize, n -= stripeSize) {
+			consumeStripe(p);
+		}
+
+		memcpy(buffer, p, n);
+		nBuffered = n;
+	}
+
+	uint64_t Xxh64::digest() const {
+		uint64_t h;
+		if (nConsumed) {
+			h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+			for (uint64_t a : acc) {
+				h = mergeRound(h, a);
+			}
+		} else {
+			h = seed + prime5;
+		}
+
+		h += nConsumed + nBuffered;
+
+		const unsigned char* p = buffer;
+		const unsigned char* end = buffer + nBuffered;
+		for (; end - p >= 8; p += 8) {
+			h = rotl(h ^ round(0, read64(p)), 27) * prime1 + prime4;
+		}
+
+		if (end - p >= 4) {
+			h = rotl(h ^ (read32(p) * prime1), 23) * prime2 + prime3;
+			p += 4;
+		}
+
+		for (; p != end; ++p) {
+			h = rotl(h ^ (*p * prime5), 11) * prime1;
+		}
+
+		h ^= h >> 33;
+		h *= prime2;
+		h ^= h >> 29;
+		h *= prime3;
+		h ^= h >> 32;
+		return h;
+	}
+}
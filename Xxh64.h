@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace commentstripper {
+	/**
+	 * Streaming XXH64, the 64-bit xxHash: fast and well distributed, though not cryptographic. Data may be appended in
+	 * pieces of any size with the same result as all at once. Also usable as a sink (it has push_back() and append()),
+	 * so stripped output can be hashed without being stored.
+	 */
+	class Xxh64 {
+	public:
+		explicit Xxh64(std::uint64_t seed = 0);
+
+		void append(const char* p, std::size_t n);
+
+		void push_back(char c) {
+			buffer[nBuffered++] = static_cast<unsigned char>(c);
+			if (nBuffered == stripeSize) {
+				consumeStripe(buffer);
+				nBuffered = 0;
+			}
+		}
+
+		/**
+		 * The hash of everything appended so far. More may be appended afterwards.
+		 */
+		std::uint64_t digest() const;
+
+	private:
+		static constexpr std::size_t stripeSize = 32;
+
+		void consumeStripe(const unsigned char* p);
+
+		std::uint64_t seed;
+		std::uint64_t acc[4];
+		unsigned char buffer[stripeSize];
+		std::size_t nBuffered = 0;
+		std::uint64_t nConsumed = 0;	// Bytes in complete stripes
+	};
+}
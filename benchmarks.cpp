@@ -0,0 +1,481 @@
+#include <benchmark/benchmark.h>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include "CommentStripper.h"
+#include "StateMachine.h"
+#include "PerfCounters.h"
+#include "BatchStripper.h"
+#include "IoUring.h"
+#include "IncrementalStripper.h"
+
+using namespace std;
+using namespace commentstripper;
+
+// Throughput benchmarks over reproducible corpora. Each corpus is generated from a fixed seed, so results are
+// comparable across commits. Track regressions by saving JSON results, e.g.:
+//
+//     ./Benchmarks --benchmark_out=results.json --benchmark_out_format=json
+//
+// Where hardware performance counters are available (see PerfCounters.h), every benchmark also reports cycles,
+// instructions, branch misses and L1d read misses per byte. E.g., to compare branch-miss rates of the table-driven
+// state machine against the nested switch it replaced:
+//
+//     ./Benchmarks --benchmark_filter='StepLoop/Mixed'
+namespace {
+	const size_t corpusSize = 8 * 1024 * 1024;
+
+	// Appends randomly chosen fragments until the corpus reaches corpusSize.
+	string makeCorpus(unsigned seed, initializer_list<const char*> fragments) {
+		vector<const char*> choices(fragments);
+		mt19937 rng(seed);
+		uniform_int_distribution<size_t> pick(0, choices.size() - 1);
+
+		string corpus;
+		corpus.reserve(corpusSize + 1024);
+		while (corpus.size() < corpusSize) {
+			corpus += choices[pick(rng)];
+		}
+
+		return corpus;
+	}
+
+	const string& commentFreeCorpus() {
+		static const string corpus = makeCorpus(1, {
+			"int x = a / b * c;\n",
+			"    return std::max(lhs, rhs);\n",
+			"for (size_t i = 0; i < n; ++i) {\n\ttotal += values[i] * weights[i];\n}\n",
+			"template <typename T> struct Wrapper { T value; };\n",
+		});
+		return corpus;
+	}
+
+	const string& commentHeavyCorpus() {
+		static const string corpus = makeCorpus(2, {
+			"/**\n * Returns the thing, computed carefully.\n * @param x The input\n */\n",
+			"// A single-line comment explaining the next line\n",
+			"int declaration(int x); ///< Trailing doc comment\n",
+			"/* short */ void f(); /* another */\n",
+		});
+		return corpus;
+	}
+
+	const string& stringHeavyCorpus() {
+		static const string corpus = makeCorpus(3, {
+			"\t{ \"name\", \"A string with // and /* inside\", 'x', '\\'' },\n",
+			"\t{ \"escaped \\\"quotes\\\" and \\\\ backslashes\", \"\\n\\t\", '\\\\', '\"' },\n",
+			"\t\"a long string literal that goes on for quite a while without any special characters\",\n",
+		});
+		return corpus;
+	}
+
+	// Embedded SQL and JSON, whose raw strings are full of what would otherwise be comment markers and quotes.
+	const string& rawStringHeavyCorpus() {
+		static const string corpus = makeCorpus(7, {
+			"auto query = R\"sql(\n\tSELECT name, total /* in cents */\n\tFROM orders -- \"recent\" only\n\tWHERE id = ?;\n)sql\";\n",
+			"const char* config = R\"json({ \"path\": \"/usr/lib/*\", \"pattern\": \"//.*$\", \"escape\": \"\\\\\" })json\";\n",
+			"db.execute(u8R\"(DELETE FROM t WHERE note LIKE '%//%')\"); // Purge\n",
+			"int x = a / b * c;\n",
+		});
+		return corpus;
+	}
+
+	const string& continuationHeavyCorpus() {
+		static const string corpus = makeCorpus(4, {
+			"#define MACRO(x) \\\n\tdo { \\\n\t\tf(x); \\\n\t} while (0)\n",
+			"/\\\n/ comment marker split by a continuation\n",
+			"\"string \\\ncontinued\" /\\\n* comment *\\\n/\n",
+		});
+		return corpus;
+	}
+
+	const string& unterminatedCommentCorpus() {
+		static const string corpus = "int x; /*" + makeCorpus(5, {
+			"text inside a comment that never ends, with * asterisks * and / slashes /\n",
+			"more ** text // and what looks like a single-line comment\n",
+		});
+		return corpus;
+	}
+
+	const string& mixedCorpus() {
+		static const string corpus = makeCorpus(6, {
+			"int x = a / b * c;\n",
+			"    return std::max(lhs, rhs);\n",
+			"const char* s = \"a string with // and /* inside\";\n",
+			"char c = '\\'';\n",
+			"// A single-line comment explaining the next line\n",
+			"/* A multiline comment\n * with several lines\n * of text */\n",
+			"x = y; /* trailing */ z = w; // and another\n",
+			"printf(\"%d\\n\", n);\n",
+		});
+		return corpus;
+	}
+
+	// The same text with Windows line endings, for comparison against its LF-only original.
+	string withCrlf(const string& text) {
+		string crlf;
+		crlf.reserve(text.size() + text.size() / 16);
+		for (char c : text) {
+			if (c == '\n') {
+				crlf += '\r';
+			}
+			crlf += c;
+		}
+
+		return crlf;
+	}
+
+	const string& crlfContinuationHeavyCorpus() {
+		static const string corpus = withCrlf(continuationHeavyCorpus());
+		return corpus;
+	}
+
+	const string& crlfMixedCorpus() {
+		static const string corpus = withCrlf(mixedCorpus());
+		return corpus;
+	}
+
+	// This repo's own sources, as a small real-world corpus.
+	const string& realSourcesCorpus() {
+		static const string corpus = [] {
+			string all;
+			for (const auto& entry : filesystem::directory_iterator(COMMENTSTRIPPER_SOURCE_DIR)) {
+				auto ext = entry.path().extension();
+				if (ext == ".cpp" || ext == ".h") {
+					ifstream ifs(entry.path(), ios::binary);
+					all.append(istreambuf_iterator<char>(ifs), istreambuf_iterator<char>());
+				}
+			}
+
+			return all;
+		}();
+		return corpus;
+	}
+
+	// The nested-switch state machine that transitionTable replaced, kept verbatim as a baseline.
+	void referenceSwitchStep(State& state, bool& backslashSeen, unsigned nPairs, char c, string& out) {
+		auto putPairs = [&] {
+			for (unsigned i = 0; i < nPairs; ++i) {
+				out.append("\\\n", 2);
+			}
+		};
+		auto put = [&] {
+			putPairs();
+			out.push_back(c);
+		};
+
+		switch (state) {
+		case State::NORMAL:
+			switch (c) {
+			case '"': state = State::IN_STRING; put(); backslashSeen = false; break;
+			case '\'': state = State::IN_CHAR; put(); backslashSeen = false; break;
+			case '\\': put(); backslashSeen = !backslashSeen; break;
+			case '/': state = State::SLASH; putPairs(); backslashSeen = false; break;
+			default: put(); backslashSeen = false; break;
+			}
+			break;
+
+		case State::IN_STRING:
+			switch (c) {
+			case '"':
+			case '\n': if (!backslashSeen) { state = State::NORMAL; } put(); backslashSeen = false; break;
+			case '\\': put(); backslashSeen = !backslashSeen; break;
+			default: put(); backslashSeen = false; break;
+			}
+			break;
+
+		case State::IN_CHAR:
+			switch (c) {
+			case '\'':
+			case '\n': if (!backslashSeen) { state = State::NORMAL; } put(); backslashSeen = false; break;
+			case '\\': put(); backslashSeen = !backslashSeen; break;
+			default: put(); backslashSeen = false; break;
+			}
+			break;
+
+		case State::SLASH:
+			switch (c) {
+			case '/': state = State::IN_SINGLE_LINE_COMMENT; break;
+			case '*': state = State::IN_MULTILINE_COMMENT; break;
+			default: state = State::NORMAL; out.push_back('/'); put(); break;
+			}
+			break;
+
+		case State::IN_SINGLE_LINE_COMMENT:
+			if (c == '\n') { state = State::NORMAL; out.push_back('\n'); }
+			break;
+
+		case State::IN_MULTILINE_COMMENT:
+			if (c == '*') { state = State::ASTERISK_IN_MULTILINE_COMMENT; }
+			break;
+
+		case State::ASTERISK_IN_MULTILINE_COMMENT:
+			switch (c) {
+			case '/': out.push_back(' '); state = State::NORMAL; break;
+			case '*': break;
+			default: state = State::IN_MULTILINE_COMMENT; break;
+			}
+			break;
+
+		default:	// The states added since (raw strings, CRs ending single-line comments) are never entered here
+			break;
+		}
+	}
+
+	void setThroughputCounters(benchmark::State& state, size_t nBytes, const PerfCounters& perfCounters) {
+		state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * nBytes));
+		state.counters["time_per_byte"] = benchmark::Counter(static_cast<double>(nBytes),
+			benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+
+		PerfCounters::Reading reading = perfCounters.read();
+		double totalBytes = static_cast<double>(state.iterations()) * nBytes;
+		for (int e = 0; e < PerfCounters::N_EVENTS; ++e) {
+			if (reading[e]) {
+				state.counters[string(PerfCounters::name(static_cast<PerfCounters::Event>(e))) + "/byte"] = *reading[e] / totalBytes;
+			}
+		}
+	}
+
+	// Many small headers, as in a third-party include tree, written once to a temporary directory. Returns the files
+	// to strip into a sibling directory.
+	const vector<BatchFile>& smallFilesTree() {
+		static const vector<BatchFile> files = [] {
+			const size_t nFiles = 2000;
+			const size_t fileSize = 4096;
+			filesystem::path root = filesystem::temp_directory_path() / "StripCppCommentsBenchmarkTree";
+			filesystem::remove_all(root);
+			filesystem::create_directories(root / "in");
+
+			const string& source = mixedCorpus();
+			vector<BatchFile> files;
+			for (size_t i = 0; i < nFiles; ++i) {
+				filesystem::path input = root / "in" / ("header" + to_string(i) + ".h");
+				ofstream(input, ios::binary).write(source.data() + i * fileSize, fileSize);
+				files.push_back({ input, root / "out" / input.filename() });
+			}
+
+			return files;
+		}();
+		return files;
+	}
+
+	// read() and write() system calls made so far by this process, from /proc/self/io, or -1 where unavailable. Opens and
+	// closes aren't counted there.
+	double readWriteSystemCalls() {
+		ifstream ifs("/proc/self/io");
+		double total = -1;
+		for (string key; ifs >> key; ) {
+			double n;
+			ifs >> n;
+			if (key == "syscr:" || key == "syscw:") {
+				total = max(total, 0.0) + n;
+			}
+		}
+
+		return total;
+	}
+
+	void BM_BatchStrip(benchmark::State& state, BatchIo io) {
+		const vector<BatchFile>& files = smallFilesTree();
+		double readWritesBefore = readWriteSystemCalls();
+		uint64_t ringEntersBefore = IoUring::nSystemCalls();
+		for (auto _ : state) {
+			auto failures = stripFiles(files, 1, nullptr, io);
+			if (!failures.empty()) {
+				state.SkipWithError(failures[0].reason.c_str());
+				break;
+			}
+		}
+
+		double nFiles = static_cast<double>(state.iterations()) * files.size();
+		state.SetItemsProcessed(static_cast<int64_t>(nFiles));
+		if (readWritesBefore >= 0) {
+			state.counters["read_write_syscalls/file"] = (readWriteSystemCalls() - readWritesBefore) / nFiles;
+		}
+
+		state.counters["io_uring_enters/file"] = (IoUring::nSystemCalls() - ringEntersBefore) / nFiles;
+	}
+
+	void BM_StripComments(benchmark::State& state, const string& (*corpus)()) {
+		const string& in = corpus();
+		string out;
+		out.reserve(in.size());
+		PerfCounters perfCounters;
+		perfCounters.start();
+		for (auto _ : state) {
+			out.clear();
+			stripComments(in, out);
+			benchmark::DoNotOptimize(out.data());
+		}
+		perfCounters.stop();
+
+		setThroughputCounters(state, in.size(), perfCounters);
+	}
+
+	// The same, also minifying whitespace, to show what the fused stage costs over stripping alone.
+	void BM_StripAndMinify(benchmark::State& state, const string& (*corpus)()) {
+		const string& in = corpus();
+		string out;
+		out.reserve(in.size());
+		PerfCounters perfCounters;
+		perfCounters.start();
+		for (auto _ : state) {
+			out.clear();
+			stripAndMinify(in, out);
+			benchmark::DoNotOptimize(out.data());
+		}
+		perfCounters.stop();
+
+		setThroughputCounters(state, in.size(), perfCounters);
+	}
+
+	// The same, also building an OffsetMap, to show what mapping costs when it is asked for.
+	void BM_StripCommentsWithOffsetMap(benchmark::State& state, const string& (*corpus)()) {
+		const string& in = corpus();
+		string out;
+		out.reserve(in.size());
+		OffsetMap map;
+		PerfCounters perfCounters;
+		perfCounters.start();
+		for (auto _ : state) {
+			out.clear();
+			stripComments(in, out, map);
+			benchmark::DoNotOptimize(out.data());
+		}
+		perfCounters.stop();
+
+		setThroughputCounters(state, in.size(), perfCounters);
+	}
+
+	// A streambuf that discards everything, so that stream benchmarks measure stripping rather than copying.
+	class NullStreambuf : public streambuf {
+	protected:
+		int_type overflow(int_type c) override { return traits_type::not_eof(c); }
+		streamsize xsputn(const char*, streamsize n) override { return n; }
+	};
+
+	void BM_StripCommentsStream(benchmark::State& state, const string& (*corpus)()) {
+		const string& in = corpus();
+		NullStreambuf nullBuf;
+		ostream os(&nullBuf);
+		PerfCounters perfCounters;
+		perfCounters.start();
+		for (auto _ : state) {
+			istringstream is(in);
+			stripComments(is, os);
+		}
+		perfCounters.stop();
+
+		setThroughputCounters(state, in.size(), perfCounters);
+	}
+
+	class NullOutputSink : public OutputSink {
+	protected:
+		void write(const char*, size_t) override {}
+	};
+
+	// Straight into an OutputSink, as main() does when writing to stdout.
+	void BM_StripCommentsSink(benchmark::State& state, const string& (*corpus)()) {
+		const string& in = corpus();
+		NullOutputSink sink;
+		PerfCounters perfCounters;
+		perfCounters.start();
+		for (auto _ : state) {
+			CommentStripper stripper;
+			stripper.feed(in, sink);
+			stripper.finish(sink);
+			sink.flush();
+		}
+		perfCounters.stop();
+
+		setThroughputCounters(state, in.size(), perfCounters);
+	}
+
+	// One-byte edits at random places in a buffer of the mixed corpus, each typed and then deleted again, as an editor
+	// would make; compare with BM_StripComments/Mixed, which is the cost of re-stripping the whole buffer instead.
+	void BM_IncrementalEdit(benchmark::State& state) {
+		IncrementalStripper incremental(mixedCorpus());
+		mt19937 rng(7);
+		for (auto _ : state) {
+			size_t offset = rng() % incremental.input().size();
+			incremental.edit(offset, 0, "x");
+			incremental.edit(offset, 1, "");
+			benchmark::DoNotOptimize(incremental.output().data());
+		}
+
+		state.SetItemsProcessed(static_cast<int64_t>(2 * state.iterations()));
+	}
+
+	// Drive one per-byte step function over every byte, without the run skipping that stripComments() does, so the
+	// cost of the state machine itself is measured.
+	void BM_SwitchStepLoop(benchmark::State& state, const string& (*corpus)()) {
+		const string& in = corpus();
+		string out;
+		out.reserve(in.size());
+		PerfCounters perfCounters;
+		perfCounters.start();
+		for (auto _ : state) {
+			State s = State::NORMAL;
+			bool backslashSeen = false;
+			out.clear();
+			for (char c : in) {
+				referenceSwitchStep(s, backslashSeen, 0, c, out);
+			}
+			benchmark::DoNotOptimize(out.data());
+		}
+		perfCounters.stop();
+
+		setThroughputCounters(state, in.size(), perfCounters);
+	}
+
+	void BM_TableStepLoop(benchmark::State& state, const string& (*corpus)()) {
+		const string& in = corpus();
+		string out;
+		out.reserve(in.size());
+		PerfCounters perfCounters;
+		perfCounters.start();
+		for (auto _ : state) {
+			PackedState s = pack(State::NORMAL, false);
+			out.clear();
+			for (char c : in) {
+				step(s, BackslashNewlines(), c, out);
+			}
+			benchmark::DoNotOptimize(out.data());
+		}
+		perfCounters.stop();
+
+		setThroughputCounters(state, in.size(), perfCounters);
+	}
+}
+
+#define COMMENTSTRIPPER_BENCHMARK_ALL_CORPORA(fn) \
+	BENCHMARK_CAPTURE(fn, CommentFree, commentFreeCorpus); \
+	BENCHMARK_CAPTURE(fn, CommentHeavy, commentHeavyCorpus); \
+	BENCHMARK_CAPTURE(fn, StringHeavy, stringHeavyCorpus); \
+	BENCHMARK_CAPTURE(fn, RawStringHeavy, rawStringHeavyCorpus); \
+	BENCHMARK_CAPTURE(fn, ContinuationHeavy, continuationHeavyCorpus); \
+	BENCHMARK_CAPTURE(fn, UnterminatedComment, unterminatedCommentCorpus); \
+	BENCHMARK_CAPTURE(fn, Mixed, mixedCorpus); \
+	BENCHMARK_CAPTURE(fn, CrlfContinuationHeavy, crlfContinuationHeavyCorpus); \
+	BENCHMARK_CAPTURE(fn, CrlfMixed, crlfMixedCorpus); \
+	BENCHMARK_CAPTURE(fn, RealSources, realSourcesCorpus)
+
+COMMENTSTRIPPER_BENCHMARK_ALL_CORPORA(BM_StripComments);
+COMMENTSTRIPPER_BENCHMARK_ALL_CORPORA(BM_StripAndMinify);
+COMMENTSTRIPPER_BENCHMARK_ALL_CORPORA(BM_StripCommentsWithOffsetMap);
+COMMENTSTRIPPER_BENCHMARK_ALL_CORPORA(BM_StripCommentsStream);
+COMMENTSTRIPPER_BENCHMARK_ALL_CORPORA(BM_StripCommentsSink);
+COMMENTSTRIPPER_BENCHMARK_ALL_CORPORA(BM_SwitchStepLoop);
+COMMENTSTRIPPER_BENCHMARK_ALL_CORPORA(BM_TableStepLoop);
+
+BENCHMARK(BM_IncrementalEdit)->Unit(benchmark::kMicrosecond);
+
+// Files per second for the two batch I/O back ends, with system calls per file. Build in Release mode, and mind that
+// with a warm page cache this measures system call overhead rather than storage
+BENCHMARK_CAPTURE(BM_BatchStrip, Blocking, BatchIo::BLOCKING)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_BatchStrip, IoUring, BatchIo::IO_URING)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -1,31 +1,627 @@
+#include <charconv>
 #include <iostream>
 #include <fstream>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
 #include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 #include "CommentStripper.h"
+#include "BatchStripper.h"
+#include "Compare.h"
+#include "PerfCounters.h"
+#include "MappedFile.h"
+#include "OutputSink.h"
+#include "StripCache.h"
 
 using namespace std;
 
+const char* const usage =
+	"Usage: StripComments [--threads N] [<] some_cpp_file.cpp > that_file_without_comments.cpp\n"
+	"       StripComments --output-dir DIR [--threads N] [path...]\n"
+	"       StripComments --fingerprint [--threads N] [path...]\n"
+	"       StripComments --compare a.cpp b.cpp\n"
+	"       StripComments --has-comments [--threads N] [path...]\n"
+	"  --stats=json        Report per-file and total statistics (bytes in each state, comments removed, etc.) as JSON\n"
+	"                      to stderr\n"
+	"  --pipeline          When streaming from stdin or a pipe, read, strip and write on separate threads, so that\n"
+	"                      slow input or output overlaps with stripping\n"
+	"  --perf-counters     Report hardware performance counters per input byte to stderr (reads the whole input\n"
+	"                      into memory first, so that only stripping is measured)\n"
+	"  --threads N         Number of threads to use. For a single input, it is read whole into memory and split\n"
+	"                      between threads; in batch mode, files are stripped in parallel (default: all cores)\n"
+	"  --output-dir DIR    Batch mode: strip every named file, and every C/C++ file under every named directory,\n"
+	"                      into a mirrored tree under DIR. With no paths, reads a list of paths from stdin\n"
+	"  --blocking-io       Batch mode: open, read and write files one system call at a time, instead of batching\n"
+	"                      them through io_uring (which is used only where available in any case)\n"
+	"  --fingerprint       Instead of writing output, print a hash of it for each input (files, or C/C++ files under\n"
+	"                      directories; stdin if none), which changes only if more than comments change\n"
+	"  --has-comments      Instead of writing output, print PATH:LINE:COLUMN of the first comment in each input\n"
+	"                      (files, or C/C++ files under directories; stdin if none) that has one, reading no further.\n"
+	"                      Exit status is 0 if any input has a comment, 1 if none do, 2 on error\n"
+	"  --compare A B       Exit with status 0 if A and B differ only in comments; otherwise print where they first\n"
+	"                      differ and exit with status 1\n"
+	"  --cache-dir DIR     Batch mode: reuse outputs for inputs stripped before, keeping them in DIR, which any\n"
+	"                      number of concurrent runs may share\n"
+	"  --cache-size MIB    Evict least recently used outputs once the cache exceeds this size (default: 1024)\n"
+	"  --offset-map FILE   Single input: also write to FILE a binary map of which input bytes were kept, dropped or\n"
+	"                      replaced, to trace output positions back to the input (see OffsetMap.h)\n"
+	"  --comments FILE     Single input: also write every comment removed to FILE, in the same pass, as one line of\n"
+	"                      JSON per comment giving its offset, line, column and text. Combines with --stats=json\n"
+	"  --preserve-lines    Single input: replace each comment with the line breaks in it, so that line numbers match\n"
+	"  --preserve-columns  Single input: replace each comment with spaces, keeping its tabs and line breaks, so that\n"
+	"                      lines and columns match\n"
+	"  --keep-doc-comments Single input: keep comments beginning /// or /** as they are, and strip the rest\n"
+	"  --minify            Single input: also minify whitespace in the same pass, keeping only what separates tokens\n"
+	"                      and the lines of preprocessor directives, and leaving literals untouched\n";
+
+struct Options {
+	unsigned nThreads = 0;	// 0 means "not given"
+	string outputDir;		// Non-empty selects batch mode
+	bool perfCounters = false;
+	bool stats = false;
+	bool pipeline = false;
+	bool blockingIo = false;
+	bool fingerprint = false;
+	bool hasComments = false;
+	vector<string> compared;	// Two paths in --compare mode
+	string cacheDir;		// Empty for no cache
+	string offsetMap;		// Where to write the OffsetMap, if non-empty
+	string comments;		// Where to write extracted comments, if non-empty
+	commentstripper::StripMode mode = commentstripper::StripMode::DROP_COMMENTS;
+	bool minify = false;
+	uintmax_t cacheMiB = 1024;
+	vector<string> paths;
+};
+
+// Parses the value of a numeric option, which must be a plain decimal number no greater than max. (stoul() would
+// accept "-1", wrapping it around, and report anything it can't parse only as "stoul".)
+uintmax_t parseCount(const string& option, const char* value, uintmax_t max) {
+	const char* end = value + char_traits<char>::length(value);
+	uintmax_t n;
+	auto [p, error] = from_chars(value, end, n);
+	if (error == errc::result_out_of_range || (error == errc() && p == end && n > max)) {
+		throw runtime_error{option + " can be at most " + to_string(max) + ", not " + value};
+	} else if (error != errc() || p != end) {
+		throw runtime_error{option + " needs a whole number, not '" + value + "'"};
+	}
+
+	return n;
+}
+
+Options parseArgs(int argc, char** argv) {
+	Options options;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if (arg == "--threads" && i + 1 < argc) {
+			options.nThreads = static_cast<unsigned>(parseCount(arg, argv[++i], numeric_limits<unsigned>::max()));
+		} else if (arg == "--output-dir" && i + 1 < argc) {
+			options.outputDir = argv[++i];
+		} else if (arg == "--stats=json") {
+			options.stats = true;
+		} else if (arg == "--cache-dir" && i + 1 < argc) {
+			options.cacheDir = argv[++i];
+		} else if (arg == "--cache-size" && i + 1 < argc) {
+			options.cacheMiB = parseCount(arg, argv[++i], numeric_limits<uintmax_t>::max() / (1024 * 1024));
+		} else if (arg == "--offset-map" && i + 1 < argc) {
+			options.offsetMap = argv[++i];
+		} else if (arg == "--comments" && i + 1 < argc) {
+			options.comments = argv[++i];
+		} else if (arg == "--compare" && i + 2 < argc) {
+			options.compared = { argv[i + 1], argv[i + 2] };
+			i += 2;
+		} else if (arg == "--preserve-lines" || arg == "--preserve-columns" || arg == "--keep-doc-comments") {
+			if (options.mode != commentstripper::StripMode::DROP_COMMENTS) {
+				throw runtime_error{"Only one of --preserve-lines, --preserve-columns and --keep-doc-comments can be given"};
+			}
+
+			options.mode = arg == "--preserve-lines" ? commentstripper::StripMode::PRESERVE_LINES :
+				arg == "--preserve-columns" ? commentstripper::StripMode::PRESERVE_COLUMNS : commentstripper::StripMode::KEEP_DOC_COMMENTS;
+		} else if (arg == "--minify") {
+			options.minify = true;
+		} else if (arg == "--has-comments") {
+			options.hasComments = true;
+		} else if (arg == "--fingerprint") {
+			options.fingerprint = true;
+		} else if (arg == "--blocking-io") {
+			options.blockingIo = true;
+		} else if (arg == "--pipeline") {
+			options.pipeline = true;
+		} else if (arg == "--perf-counters") {
+			options.perfCounters = true;
+		} else if (arg.size() > 1 && arg[0] == '-') {
+			throw runtime_error{"Unexpected argument '" + arg + "'"};
+		} else {
+			options.paths.push_back(arg);
+		}
+	}
+
+	if (!options.compared.empty() && argc != 4) {
+		throw runtime_error{"--compare can't be combined with other arguments"};
+	}
+
+	if (options.fingerprint && options.hasComments) {
+		throw runtime_error{"--fingerprint can't be combined with --has-comments"};
+	}
+
+	bool query = options.fingerprint || options.hasComments;
+	if (query && (!options.outputDir.empty() || options.stats || options.perfCounters || options.pipeline)) {
+		throw runtime_error{"--fingerprint and --has-comments can't be combined with --output-dir, --stats, --perf-counters or --pipeline"};
+	}
+
+	if (options.outputDir.empty() && !query && options.paths.size() > 1) {
+		throw runtime_error{"Multiple input files need --output-dir"};
+	}
+
+	if (!options.outputDir.empty() && options.perfCounters) {
+		throw runtime_error{"--perf-counters is not supported in batch mode"};
+	}
+
+	if (options.pipeline && (options.stats || options.perfCounters || options.nThreads > 1 || !options.outputDir.empty())) {
+		throw runtime_error{"--pipeline can't be combined with --stats, --perf-counters, --threads or --output-dir"};
+	}
+
+	if (!options.cacheDir.empty() && options.outputDir.empty()) {
+		throw runtime_error{"--cache-dir needs --output-dir"};
+	}
+
+	if (!options.offsetMap.empty() && (query || !options.outputDir.empty() || options.stats || options.perfCounters || options.pipeline || options.nThreads > 1)) {
+		throw runtime_error{"--offset-map is only supported for a single input, without --stats, --perf-counters, --pipeline or --threads"};
+	}
+
+	if (!options.comments.empty() && (query || !options.outputDir.empty() || !options.offsetMap.empty() || options.perfCounters || options.pipeline || options.nThreads > 1)) {
+		throw runtime_error{"--comments is only supported for a single input, without --offset-map, --perf-counters, --pipeline or --threads"};
+	}
+
+	bool otherMode = options.mode != commentstripper::StripMode::DROP_COMMENTS;
+	if (otherMode && (query || !options.outputDir.empty() || !options.offsetMap.empty() || !options.comments.empty() || options.stats ||
+		options.perfCounters || options.pipeline || options.nThreads > 1)) {
+		throw runtime_error{"--preserve-lines, --preserve-columns and --keep-doc-comments are only supported for a single input, "
+			"without --offset-map, --comments, --stats, --perf-counters, --pipeline or --threads"};
+	}
+
+	if (options.minify && (otherMode || query || !options.outputDir.empty() || !options.offsetMap.empty() || !options.comments.empty() ||
+		options.stats || options.perfCounters || options.pipeline || options.nThreads > 1)) {
+		throw runtime_error{"--minify is only supported for a single input, without --preserve-lines, --preserve-columns, "
+			"--keep-doc-comments, --offset-map, --comments, --stats, --perf-counters, --pipeline or --threads"};
+	}
+
+	if (options.outputDir.empty() && options.stats && options.nThreads > 1) {
+		throw runtime_error{"--stats is not supported with --threads for a single input"};
+	}
+
+	return options;
+}
+
+string readAll(istream& is) {
+	string s;
+	const size_t blockSize = 1024 * 1024;
+	while (is) {
+		size_t oldSize = s.size();
+		s.resize(oldSize + blockSize);
+		is.read(&s[oldSize], blockSize);
+		s.resize(oldSize + is.gcount());
+	}
+
+	if (is.bad()) {
+		throw runtime_error{"An unexpected error occurred while reading input"};
+	}
+
+	return s;
+}
+
+void reportPerfCounters(const commentstripper::PerfCounters& counters, size_t nBytes) {
+	using commentstripper::PerfCounters;
+	if (!counters.anyAvailable()) {
+		cerr << "Performance counters unavailable: " << counters.unavailableReason() << endl;
+		return;
+	}
+
+	PerfCounters::Reading reading = counters.read();
+	cerr << "Performance counters over " << nBytes << " input bytes:\n";
+	for (int e = 0; e < PerfCounters::N_EVENTS; ++e) {
+		cerr << "  " << PerfCounters::name(static_cast<PerfCounters::Event>(e)) << "/byte: ";
+		if (reading[e]) {
+			cerr << *reading[e] / max<size_t>(nBytes, 1) << '\n';
+		} else {
+			cerr << "unavailable\n";
+		}
+	}
+}
+
+void writeJsonString(ostream& os, const string& s) {
+	os << '"';
+	for (char c : s) {
+		if (c == '"' || c == '\\') {
+			os << '\\' << c;
+		} else if (static_cast<unsigned char>(c) < 0x20) {
+			os << "\\u" << hex << setw(4) << setfill('0') << static_cast<int>(c) << dec << setfill(' ');
+		} else {
+			os << c;
+		}
+	}
+	os << '"';
+}
+
+void writeStatsJson(ostream& os, const commentstripper::StripStats& stats) {
+	using namespace commentstripper;
+	os << "{\"inputBytes\":" << stats.inputBytes
+		<< ",\"outputBytes\":" << stats.outputBytes
+		<< ",\"removalRatio\":" << (stats.inputBytes ? 1.0 - double(stats.outputBytes) / stats.inputBytes : 0.0)
+		<< ",\"commentsRemoved\":" << stats.commentsRemoved
+		<< ",\"continuationPairs\":" << stats.continuationPairs
+		<< ",\"elapsedSeconds\":" << stats.elapsedSeconds
+		<< ",\"bytesInState\":{";
+	for (size_t i = 0; i < nStates; ++i) {
+		os << (i ? "," : "") << '"' << stateName(static_cast<State>(i)) << "\":" << stats.bytesInState[i];
+	}
+	os << "}}";
+}
+
+// Writes {"files":[{"path":...,<stats>}...],"total":{<stats>}}.
+void reportStats(const vector<string>& paths, const vector<commentstripper::StripStats>& stats) {
+	commentstripper::StripStats total;
+	cerr << "{\"files\":[";
+	for (size_t i = 0; i < stats.size(); ++i) {
+		cerr << (i ? ",\n" : "\n") << "{\"path\":";
+		writeJsonString(cerr, paths[i]);
+		cerr << ",\"stats\":";
+		writeStatsJson(cerr, stats[i]);
+		cerr << '}';
+		total += stats[i];
+	}
+	cerr << "],\n\"total\":";
+	writeStatsJson(cerr, total);
+	cerr << "}" << endl;
+}
+
+void writeOffsetMap(const string& path, const commentstripper::OffsetMap& map) {
+	ofstream ofs(path, ios::binary);
+	string encoded = map.encoded();
+	ofs.write(encoded.data(), encoded.size());
+	if (!ofs.flush()) {
+		throw runtime_error{"Could not write offset map '" + path + "'"};
+	}
+}
+
+// Writes each comment as a line of JSON: {"offset":...,"line":...,"column":...,"text":"..."}.
+class JsonLinesCommentSink : public commentstripper::CommentSink {
+public:
+	explicit JsonLinesCommentSink(const string& path) : path(path), ofs(path, ios::binary) {
+		if (!ofs) {
+			throw runtime_error{"Could not open comments file '" + path + "'"};
+		}
+	}
+
+	void beginComment(const commentstripper::SourceLocation& start) override {
+		this->start = start;
+		text.clear();
+	}
+
+	void append(const char* p, size_t n) override {
+		text.append(p, n);
+	}
+
+	void endComment() override {
+		ofs << "{\"offset\":" << start.offset << ",\"line\":" << start.line << ",\"column\":" << start.column << ",\"text\":";
+		writeJsonString(ofs, text);
+		ofs << "}\n";
+	}
+
+	void close() {
+		if (!ofs.flush()) {
+			throw runtime_error{"Could not write comments file '" + path + "'"};
+		}
+	}
+
+private:
+	string path;
+	ofstream ofs;
+	commentstripper::SourceLocation start{};
+	string text;
+};
+
+// Strips in, which is already in memory, to stdout.
+void runOnBuffer(const Options& options, string_view in, commentstripper::StripStats& stats) {
+	commentstripper::FdOutputSink stdoutSink(1);	// Nothing else writes to stdout, so bypass cout
+	if (!options.offsetMap.empty()) {
+		string out;
+		commentstripper::OffsetMap map;
+		commentstripper::stripComments(in, out, map);
+		stdoutSink.append(out.data(), out.size());
+		stdoutSink.flush();
+		writeOffsetMap(options.offsetMap, map);
+	} else if (options.minify) {
+		string out;
+		commentstripper::stripAndMinify(in, out);
+		stdoutSink.append(out.data(), out.size());
+		stdoutSink.flush();
+	} else if (options.mode != commentstripper::StripMode::DROP_COMMENTS) {
+		string out;
+		commentstripper::stripComments(in, out, options.mode);
+		stdoutSink.append(out.data(), out.size());
+		stdoutSink.flush();
+	} else if (!options.comments.empty()) {
+		string out;
+		JsonLinesCommentSink comments(options.comments);
+		if (options.stats) {
+			commentstripper::stripComments(in, out, comments, stats);
+		} else {
+			commentstripper::stripComments(in, out, comments);
+		}
+
+		stdoutSink.append(out.data(), out.size());
+		stdoutSink.flush();
+		comments.close();
+	} else if (options.nThreads > 1 || options.perfCounters || options.stats) {
+		string out;
+		optional<commentstripper::PerfCounters> counters;	// Opening them costs system calls, so only when asked for
+		if (options.perfCounters) {
+			counters.emplace();
+			counters->start();
+		}
+
+		if (options.nThreads > 1) {
+			commentstripper::stripCommentsParallel(in, out, options.nThreads);
+		} else if (options.stats) {
+			commentstripper::stripComments(in, out, stats);
+		} else {
+			commentstripper::stripComments(in, out);
+		}
+
+		if (counters) {
+			counters->stop();
+		}
+
+		stdoutSink.append(out.data(), out.size());
+		stdoutSink.flush();
+		if (counters) {
+			reportPerfCounters(*counters, in.size());
+		}
+	} else {
+		// Long comment-free stretches are handed to the kernel as pointers into in, without being copied
+		commentstripper::WritevOutputSink sink(1, in.data(), in.data() + in.size());
+		commentstripper::CommentStripper stripper;
+		stripper.feed(in, sink);
+		stripper.finish(sink);
+		sink.flush();
+	}
+}
+
+int runSingle(const Options& options) {
+	const char* inputFileName = options.paths.empty() ? nullptr : options.paths[0].c_str();
+	commentstripper::StripStats stats;
+	auto finish = [&] {
+		if (options.stats) {
+			reportStats({ inputFileName ? inputFileName : "-" }, { stats });
+		}
+
+		return 0;
+	};
+
+	// Regular files are mapped rather than read. Pipes and stdin can't be, so are streamed
+	if (inputFileName) {
+		commentstripper::MappedFile mapped(inputFileName);
+		if (mapped.isMapped()) {
+			runOnBuffer(options, mapped.contents(), stats);
+			return finish();
+		}
+	}
+
+	istream* namedInputFile = (inputFileName ? new ifstream(inputFileName) : nullptr);
+	if (namedInputFile && !*namedInputFile) {
+		delete namedInputFile;
+		cerr << "Could not open input file '" << inputFileName << "', aborting." << endl;
+		return 1;
+	}
+
+	istream& is = namedInputFile ? *namedInputFile : cin;
+	if (options.nThreads > 1 || options.perfCounters) {
+		runOnBuffer(options, readAll(is), stats);
+	} else {
+		commentstripper::FdOutputSink stdoutSink(1);
+		if (!options.offsetMap.empty()) {
+			commentstripper::OffsetMap map;
+			commentstripper::stripComments(is, stdoutSink, map);
+			writeOffsetMap(options.offsetMap, map);
+		} else if (options.minify) {
+			commentstripper::stripAndMinify(is, stdoutSink);
+		} else if (options.mode != commentstripper::StripMode::DROP_COMMENTS) {
+			commentstripper::stripComments(is, stdoutSink, options.mode);
+		} else if (!options.comments.empty()) {
+			JsonLinesCommentSink comments(options.comments);
+			if (options.stats) {
+				commentstripper::stripComments(is, stdoutSink, comments, stats);
+			} else {
+				commentstripper::stripComments(is, stdoutSink, comments);
+			}
+
+			comments.close();
+		} else if (options.pipeline) {
+			commentstripper::stripCommentsPipelined(is, stdoutSink);
+		} else if (options.stats) {
+			commentstripper::stripComments(is, stdoutSink, stats);
+		} else {
+			commentstripper::stripComments(is, stdoutSink);
+		}
+	}
+
+	delete namedInputFile;
+	return finish();
+}
+
+int runBatch(const Options& options) {
+	vector<filesystem::path> paths(options.paths.begin(), options.paths.end());
+	if (paths.empty()) {
+		for (string line; getline(cin, line); ) {
+			if (!line.empty()) {
+				paths.push_back(line);
+			}
+		}
+	}
+
+	auto files = commentstripper::collectBatchFiles(paths, options.outputDir);
+	unsigned nThreads = options.nThreads ? options.nThreads : max(thread::hardware_concurrency(), 1u);
+	vector<commentstripper::StripStats> stats;
+	auto io = options.blockingIo ? commentstripper::BatchIo::BLOCKING : commentstripper::BatchIo::IO_URING;
+	unique_ptr<commentstripper::StripCache> cache;
+	if (!options.cacheDir.empty()) {
+		cache = make_unique<commentstripper::StripCache>(options.cacheDir, options.cacheMiB * 1024 * 1024);
+	}
+
+	auto failures = commentstripper::stripFiles(files, nThreads, options.stats ? &stats : nullptr, io, cache.get());
+
+	for (const auto& failure : failures) {
+		cerr << "Could not strip '" << failure.input.string() << "': " << failure.reason << endl;
+	}
+
+	if (options.stats) {
+		vector<string> names;
+		for (const auto& file : files) {
+			names.push_back(file.input.string());
+		}
+
+		reportStats(names, stats);
+	}
+
+	return failures.empty() ? 0 : 1;
+}
+
+// Files, and C/C++ files under directories, as in batch mode.
+vector<filesystem::path> queryInputs(const Options& options) {
+	vector<filesystem::path> inputs;
+	for (const auto& file : commentstripper::collectBatchFiles({ options.paths.begin(), options.paths.end() }, {})) {
+		inputs.push_back(file.input);
+	}
+
+	return inputs;
+}
+
+unsigned queryThreads(const Options& options) {
+	return options.nThreads ? options.nThreads : max(thread::hardware_concurrency(), 1u);
+}
+
+// Returns the inputs that failed.
+set<filesystem::path> reportQueryFailures(const string& verb, const vector<commentstripper::BatchFailure>& failures) {
+	set<filesystem::path> failed;
+	for (const auto& failure : failures) {
+		cerr << "Could not " << verb << " '" << failure.input.string() << "': " << failure.reason << endl;
+		failed.insert(failure.input);
+	}
+
+	return failed;
+}
+
+// Prints "<path>:<line>:<column>" for each input with a comment, like compilers' diagnostics.
+int runHasComments(const Options& options) {
+	auto printLocation = [](const string& path, const commentstripper::SourceLocation& location) {
+		cout << path << ':' << location.line << ':' << location.column << '\n';
+	};
+
+	if (options.paths.empty()) {
+		auto location = commentstripper::findFirstComment(cin);
+		if (location) {
+			printLocation("-", *location);
+		}
+
+		cout.flush();
+		return location ? 0 : 1;
+	}
+
+	vector<filesystem::path> inputs = queryInputs(options);
+	vector<optional<commentstripper::SourceLocation>> locations;
+	auto failures = commentstripper::findFirstComments(inputs, queryThreads(options), locations);
+	reportQueryFailures("check", failures);
+	bool anyComments = false;
+	for (size_t i = 0; i < inputs.size(); ++i) {
+		if (locations[i]) {
+			printLocation(inputs[i].string(), *locations[i]);
+			anyComments = true;
+		}
+	}
+
+	cout.flush();
+	return !failures.empty() ? 2 : anyComments ? 0 : 1;
+}
+
+// Prints "<digest>  <path>" lines, like sha256sum and friends.
+int runFingerprint(const Options& options) {
+	auto printDigest = [](uint64_t digest, const string& path) {
+		cout << hex << setw(16) << setfill('0') << digest << dec << "  " << path << '\n';
+	};
+
+	if (options.paths.empty()) {
+		printDigest(commentstripper::fingerprint(cin), "-");
+		return 0;
+	}
+
+	vector<filesystem::path> inputs = queryInputs(options);
+	vector<uint64_t> digests;
+	auto failures = commentstripper::fingerprintFiles(inputs, queryThreads(options), digests);
+	set<filesystem::path> failed = reportQueryFailures("fingerprint", failures);
+
+	for (size_t i = 0; i < inputs.size(); ++i) {
+		if (!failed.count(inputs[i])) {
+			printDigest(digests[i], inputs[i].string());
+		}
+	}
+
+	cout.flush();
+	return failures.empty() ? 0 : 1;
+}
+
+int runCompare(const Options& options) {
+	ifstream a(options.compared[0], ios::binary);
+	ifstream b(options.compared[1], ios::binary);
+	for (size_t i = 0; i < 2; ++i) {
+		if (!(i ? b : a)) {
+			cerr << "Could not open input file '" << options.compared[i] << "', aborting." << endl;
+			return 2;
+		}
+	}
+
+	auto difference = commentstripper::findFirstDifference(a, b);
+	if (!difference) {
+		return 0;
+	}
+
+	auto describe = [](const string& path, const commentstripper::SourceLocation& location) {
+		return path + ':' + to_string(location.line) + ':' + to_string(location.column) + " (byte " + to_string(location.offset) + ')';
+	};
+	cout << describe(options.compared[0], difference->a) << " and " << describe(options.compared[1], difference->b)
+		<< " differ other than in comments" << endl;
+	return 1;
+}
+
 int main(int argc, char** argv) {
 	ios_base::sync_with_stdio(false);	// We never use stdio (printf() etc.). Improves perf
 	cin.tie(nullptr);	// Avoid flushing at every write->read transition. Improves perf
 
 	if (argc == 2 && set<string>{"--help", "-h", "/?"}.count(argv[1])) {
-		cerr << "Usage: StripComments [<] some_cpp_file.cpp > that_file_without_comments.cpp\n";
+		cerr << usage;
 		return 0;
 	}
 
 	try {
-		istream* namedInputFile = (argc == 2 ? new ifstream(argv[1]) : nullptr);
-		if (namedInputFile && !*namedInputFile) {
-			delete namedInputFile;
-			cerr << "Could not open input file '" << argv[1] << "', aborting." << endl;
-			return 1;
+		Options options = parseArgs(argc, argv);
+		if (!options.compared.empty()) {
+			return runCompare(options);
 		}
 
-		commentstripper::stripComments(namedInputFile ? *namedInputFile : cin, cout);
+		if (options.fingerprint) {
+			return runFingerprint(options);
+		}
 
-		delete namedInputFile;
-		return 0;
+		if (options.hasComments) {
+			return runHasComments(options);
+		}
+
+		return options.outputDir.empty() ? runSingle(options) : runBatch(options);
 	} catch (exception& e) {
 		cerr << "An error occurred: " << e.what() << endl;
 		return 1;
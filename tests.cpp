@@ -2,7 +2,25 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <atomic>
+#include <filesystem>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <set>
+#include <random>
 #include "CommentStripper.h"
+#include "ByteScanner.h"
+#include "BatchStripper.h"
+#include "Compare.h"
+#include "IncrementalStripper.h"
+#include "IoUring.h"
+#include "OffsetMap.h"
+#include "WorkStealingPool.h"
+#include "OutputSink.h"
+#include "SpscRing.h"
+#include "StripCache.h"
+#include "Xxh64.h"
 
 using namespace std;
 using namespace commentstripper;
@@ -191,6 +209,13 @@ TEST(CommentStripper, MulticharLiteralContainingSingleLineCommentIsUnchanged) {
 	EXPECT_UNCHANGED();
 }
 
+TEST(CommentStripper, LiteralsRightAfterSlashContainingSingleLineCommentAreUnchanged) {
+	istringstream iss("x = a/\"//not a comment\" + b/'//'");
+	ostringstream oss;
+	stripComments(iss, oss);
+	EXPECT_UNCHANGED();
+}
+
 // Multiline comments.
 // Note that multiline comments are replaced with a single space so that "abc/*---*/def" continues to parse as 2 tokens.
 TEST(CommentStripper, MultilineCommentAtStartIsRemoved) {
@@ -313,6 +338,13 @@ TEST(CommentStripper, JustBackslashNewlineIsUnchanged) {
 	EXPECT_UNCHANGED();
 }
 
+TEST(CommentStripper, SlashThenBackslashNewlineAtEndIsUnchanged) {
+	istringstream iss("a/\\\n");
+	ostringstream oss;
+	stripComments(iss, oss);
+	EXPECT_UNCHANGED();
+}
+
 TEST(CommentStripper, JustTwoBackslashNewlinesIsUnchanged) {
 	istringstream iss("\\\n\\\n");
 	ostringstream oss;
@@ -507,10 +539,71 @@ TEST(CommentStripper, BackslashNewlineDoesNotInterruptDoubleQuoteEscapeSequenceI
 	);
 }
 
-// Tests that would fail if "DISABLED_" were removed from their names, due to limitations in the code
+// Line continuations with CR LF line endings
+TEST(CommentStripper, HandlesCarriageReturnInLineContinuation) {
+	istringstream iss(
+		"// Comment split into 2 lines using\\\r\n"
+		" a line continuation containing a carriage return"
+	);
+	ostringstream oss;
+	stripComments(iss, oss);
+	EXPECT_STREQ(oss.str().c_str(), "");
+}
 
-// Handling raw strings (available since C++11) would require 16-character lookahead to check the delimiters
-TEST(CommentStripper, DISABLED_RawStringWithCommentInDelimitersAndContainingCommentIsUnchanged) {
+TEST(CommentStripper, CarriageReturnEndingSingleLineCommentIsKept) {
+	istringstream iss("int a; // c\r\nint b; //\r\r\n//a\rb\n//x\r\\\n\ny");
+	ostringstream oss;
+	stripComments(iss, oss);
+	EXPECT_STREQ(oss.str().c_str(), "int a; \r\nint b; \r\n\n\ny");
+}
+
+TEST(CommentStripper, MixedLineContinuationsAreReproducedExactly) {
+	istringstream iss("a/\\\r\n\\\n\\\r\nb /\\\r\n\\\n* c *\\\r\n/ d \"s\\\r\n\" //e\\\r\nf\r\ng\\\r\n");
+	ostringstream oss;
+	stripComments(iss, oss);
+	EXPECT_STREQ(oss.str().c_str(), "a/\\\r\n\\\n\\\r\nb   d \"s\\\r\n\" \r\ng\\\r\n");
+}
+
+TEST(CommentStripper, LongRunsOfMixedLineContinuationsAreReproducedExactly) {
+	string pairs, lineBreaks;	// More than 64 pairs, mixing endings after the 64th
+	for (int i = 0; i < 200; ++i) {
+		bool crlf = (i < 64 || i % 3 == 0 || i % 7 == 0);
+		pairs += crlf ? "\\\r\n" : "\\\n";
+		lineBreaks += crlf ? "\r\n" : "\n";
+	}
+
+	string in = "x" + pairs + "y \"s" + pairs + "\" a/" + pairs + "b /" + pairs + "* c " + pairs + "*/ d //" + pairs + "e\n";
+	string out;
+	stripComments(in, out);
+	EXPECT_EQ(out, "x" + pairs + "y \"s" + pairs + "\" a/" + pairs + "b   d \n");
+
+	in = "//" + pairs + "e\n";
+	out.clear();
+	stripComments(in, out, StripMode::PRESERVE_LINES);
+	EXPECT_EQ(out, lineBreaks + "\n");
+
+	StripStats stats;
+	OffsetMap map;
+	in = "x" + pairs + "\\\n\\\ny\n";
+	out.clear();
+	stripComments(in, out, stats);
+	EXPECT_EQ(out, in);
+	EXPECT_EQ(stats.inputBytes, in.size());
+	EXPECT_EQ(stats.bytesInState[static_cast<size_t>(State::NORMAL)], in.size());
+	stripComments(in, out, map);
+	EXPECT_EQ(map.inputSize(), in.size());
+	EXPECT_EQ(map.outputSize(), in.size());
+}
+
+TEST(CommentStripper, BackslashCarriageReturnWithoutNewlineIsNoContinuation) {
+	istringstream iss("x\\\ry // c\\\r\nz\n\\\r");
+	ostringstream oss;
+	stripComments(iss, oss);
+	EXPECT_STREQ(oss.str().c_str(), "x\\\ry \n\\\r");
+}
+
+// Raw strings (available since C++11)
+TEST(CommentStripper, RawStringWithCommentInDelimitersAndContainingCommentIsUnchanged) {
 	istringstream iss(
 		"cout << R\"\"//NOODLE(\n"		// "/", "\"" are permitted in raw string delimiters
 		"Some text\n"
@@ -530,6 +623,1215 @@ Some text
 	};
 }
 
+TEST(CommentStripper, RawStringsWithEveryPrefixAreUnchanged) {
+	istringstream iss("u8R\"(//a)\" LR\"(/*b*/)\" uR\"x(//c)x\" UR\"(\"//d)\" R\"(\\)\"");
+	ostringstream oss;
+	stripComments(iss, oss);
+	EXPECT_UNCHANGED();
+}
+
+TEST(CommentStripper, IdentifierEndingInRDoesNotBeginRawString) {
+	istringstream iss("XR\"(\" // comment\nu8XR\"(\" // comment");
+	ostringstream oss;
+	stripComments(iss, oss);
+	EXPECT_STREQ(oss.str().c_str(), "XR\"(\" \nu8XR\"(\" ");
+}
+
+TEST(CommentStripper, BackslashNewlineInRawStringClosingSequenceDoesNotEndIt) {
+	istringstream iss(
+		"R\"x(a)x\\\n"
+		"\" // still in the string\n"
+		")\\\n"
+		"x\" // still in the string\n"
+		")x\" // comment"
+	);
+	ostringstream oss;
+	stripComments(iss, oss);
+	EXPECT_STREQ(oss.str().c_str(),
+		"R\"x(a)x\\\n"
+		"\" // still in the string\n"
+		")\\\n"
+		"x\" // still in the string\n"
+		")x\" "
+	);
+}
+
+TEST(CommentStripper, RawStringWithInvalidDelimiterIsTreatedAsOrdinaryString) {
+	istringstream iss(
+		"R\"12345678901234567(\"//comment\n"	// Delimiter too long
+		"R\"a b(\"//comment\n"
+		"R\\\n"
+		"\"a\\\n"
+		"(\"//comment"
+	);
+	ostringstream oss;
+	stripComments(iss, oss);
+	EXPECT_STREQ(oss.str().c_str(),
+		"R\"12345678901234567(\"\n"
+		"R\"a b(\"\n"
+		"R\\\n"
+		"\"a\\\n"
+		"(\""
+	);
+}
+
+TEST(CommentStripper, LongRawStringIsUnchanged) {
+	string body;
+	for (int i = 0; i < 1000; ++i) {
+		body += "SELECT x FROM t; -- /* not a comment */ \")sq\" )sqlx\" )sql // still not\n";
+	}
+
+	string in = "auto q = R\"sql(" + body + ")sql\"; // comment";
+	string out;
+	stripComments(in, out);
+	EXPECT_EQ(out, "auto q = R\"sql(" + body + ")sql\"; ");
+}
+
+// Contiguous-buffer overload
+TEST(CommentStripper, BufferOverloadAppendsToExistingOutput) {
+	string out = "Prefix:";
+	stripComments(string_view("abc/* multiline comment */def // single-line comment\n"), out);
+	EXPECT_EQ(out, "Prefix:abc def \n");
+}
+
+TEST(CommentStripper, BufferOverloadPreservesNulChars) {
+	const char rawStr[] = "a\0/*\0*/b\0//\0\n\0";
+	string out;
+	stripComments(string_view(rawStr, sizeof rawStr - 1), out);
+	EXPECT_EQ(out, string("a\0 b\0\n\0", 7));
+}
+
+TEST(CommentStripper, StreamOverloadHandlesBackslashNewlineSplitAcrossBlocks) {
+	// The stream overload reads 64KiB blocks; place a line continuation inside a comment marker at every offset near
+	// the first block boundary
+	for (size_t pad = 65530; pad < 65540; ++pad) {
+		istringstream iss(string(pad, 'x') + "/\\\n/ comment\nint y;");
+		ostringstream oss;
+		stripComments(iss, oss);
+		EXPECT_EQ(oss.str(), string(pad, 'x') + "\nint y;");
+	}
+}
+
+// Vectorised scanning
+TEST(ByteScanner, FindFirstOfFindsEveryNeedleAtEveryOffset) {
+	for (char needle : { '"', '\'', '/', '\\' }) {
+		for (size_t len = 0; len < 100; ++len) {
+			for (size_t pos = 0; pos <= len; ++pos) {
+				string s(len, 'x');
+				if (pos < len) {
+					s[pos] = needle;
+				}
+
+				const char* found = findFirstOf(s.data(), s.data() + s.size(), '"', '\'', '/', '\\');
+				EXPECT_EQ(found - s.data(), pos);
+			}
+		}
+	}
+}
+
+TEST(ByteScanner, FindBackslashNewlineFindsPairsAndTrailingBackslashAtEveryOffset) {
+	for (size_t len = 1; len < 200; ++len) {
+		for (size_t pos = 0; pos < len; ++pos) {
+			string s(len, 'x');
+			s[pos] = '\\';
+			if (pos + 1 < len) {
+				s[pos + 1] = '\n';
+			}
+
+			EXPECT_EQ(findBackslashNewline(s.data(), s.data() + s.size()) - s.data(), pos);
+
+			if (pos + 1 < len) {	// A backslash followed by anything else does not count
+				s[pos + 1] = 'x';
+				EXPECT_EQ(findBackslashNewline(s.data(), s.data() + s.size()) - s.data(), len);
+			}
+
+			if (pos + 1 < len) {	// Nor does one followed by a CR and anything but a newline, unless the CR is last
+				s[pos + 1] = '\r';
+				EXPECT_EQ(findBackslashNewline(s.data(), s.data() + s.size()) - s.data(), pos + 2 == len ? pos : len);
+			}
+
+			if (pos + 2 < len) {
+				s[pos + 2] = '\n';
+				EXPECT_EQ(findBackslashNewline(s.data(), s.data() + s.size()) - s.data(), pos);
+			}
+		}
+	}
+}
+
+TEST(ByteScanner, FindBackslashNewlineLooksPastBackslashCarriageReturnWithoutNewline) {
+	for (size_t pos = 0; pos < 150; ++pos) {
+		string s(200, 'x');
+		s[pos] = '\\';
+		s[pos + 1] = '\r';
+		s[pos + 40] = '\\';
+		s[pos + 41] = '\n';
+		EXPECT_EQ(findBackslashNewline(s.data(), s.data() + s.size()) - s.data(), pos + 40);
+	}
+}
+
+TEST(ByteScanner, CountByteCountsPastLaneOverflow) {
+	string s;
+	for (size_t i = 0; i < 16 * 600 + 7; ++i) {
+		s += (i % 3 ? 'x' : '\n');
+	}
+
+	for (size_t begin : { 0, 1, 15 }) {
+		for (size_t end : { s.size(), s.size() - 1, begin + 17 }) {
+			EXPECT_EQ(countByte(s.data() + begin, s.data() + end, '\n'), static_cast<size_t>(count(s.begin() + begin, s.begin() + end, '\n')));
+		}
+	}
+
+	string allNewlines(16 * 300, '\n');	// Every lane counts past 255
+	EXPECT_EQ(countByte(allNewlines.data(), allNewlines.data() + allNewlines.size(), '\n'), allNewlines.size());
+}
+
+TEST(CommentStripper, BackslashNewlineAtEveryBlockOffsetInsideCommentsIsHandled) {
+	for (size_t pad = 0; pad < 130; ++pad) {
+		string in = string(pad, 'x') + "/\\\n* a \\\nb *\\\n/y // c\\\nd\nz\\";
+		string out;
+		stripComments(in, out);
+		EXPECT_EQ(out, string(pad, 'x') + " y \nz\\");
+	}
+}
+
+TEST(CommentStripper, LongRunsInEveryStateAreHandled) {
+	string filler(1000, 'x');
+	string in = filler + "\"" + filler + "\\\"" + filler + "\"" + filler + "'" + filler + "'" + filler +
+		"/*" + filler + "*/" + filler + "//" + filler + "\n" + filler;
+	string out;
+	stripComments(in, out);
+	EXPECT_EQ(out, filler + "\"" + filler + "\\\"" + filler + "\"" + filler + "'" + filler + "'" + filler +
+		" " + filler + "\n" + filler);
+}
+
+// Parallel stripping
+namespace {
+	void expectParallelMatchesSequential(const string& in) {
+		string sequential;
+		stripComments(in, sequential);
+		for (unsigned nThreads : { 2, 3, 8 }) {
+			string parallel;
+			stripCommentsParallel(in, parallel, nThreads);
+			EXPECT_TRUE(parallel == sequential) << "with " << nThreads << " threads";
+		}
+	}
+}
+
+TEST(CommentStripperParallel, MixedInputMatchesSequential) {
+	string in;
+	for (unsigned i = 0; in.size() < 8 * 1024 * 1024; ++i) {
+		in += "int x = a / b; // comment " + to_string(i) + "\n";
+		in += "const char* s = \"string with /* and \\\n continuation\";\n";
+		in += (i % 1000 == 0 ? "/* multiline comment\n spanning\n lines */\n" : "char c = '\\'';\n");
+	}
+
+	expectParallelMatchesSequential(in);
+}
+
+TEST(CommentStripperParallel, UnterminatedCommentSpanningAllChunksMatchesSequential) {
+	string in = "code /* never closed\n";
+	while (in.size() < 8 * 1024 * 1024) {
+		in += "int x = 1; // not a comment of its own\n";
+	}
+
+	expectParallelMatchesSequential(in);
+}
+
+TEST(CommentStripperParallel, CommentsEndingAtEveryPossibleChunkStateMatchSequential) {
+	// Each line leaves the state machine somewhere different at the newline: inside a string (escaped newline), inside a
+	// character literal, inside a multiline comment, etc.
+	string in;
+	while (in.size() < 8 * 1024 * 1024) {
+		in += "\"str\\\n\"'c\\\n'x/* a\n*/y/\n\\\\\n/";
+	}
+
+	expectParallelMatchesSequential(in);
+}
+
+TEST(CommentStripperParallel, RawStringsSpanningChunkBoundariesMatchSequential) {
+	// Chunks that start inside a raw string can't be speculated on, so are stripped again once their state is known
+	string in;
+	for (unsigned i = 0; in.size() < 8 * 1024 * 1024; ++i) {
+		in += "auto q = R\"sql(\n";
+		for (unsigned j = 0; j < i % 5000; ++j) {
+			in += "SELECT x FROM t /* not a comment */; // nor this\n";
+		}
+		in += ")sql\"; // comment\n";
+	}
+
+	expectParallelMatchesSequential(in);
+}
+
+TEST(CommentStripperParallel, CrlfLineEndingsMatchSequential) {
+	string in;
+	while (in.size() < 8 * 1024 * 1024) {
+		in += "\"str\\\r\n\"'c\\\r\n'x/* a\r\n*/y // z\\\r\n\r\n";
+	}
+
+	expectParallelMatchesSequential(in);
+}
+
+// Batch mode
+TEST(WorkStealingPool, RunsEveryTaskExactlyOnce) {
+	const size_t nTasks = 1000;
+	vector<atomic<int>> counts(nTasks);
+	vector<function<void()>> tasks;
+	for (size_t i = 0; i < nTasks; ++i) {
+		tasks.push_back([&counts, i] { ++counts[i]; });
+	}
+
+	WorkStealingPool(4).run(move(tasks));
+	for (size_t i = 0; i < nTasks; ++i) {
+		EXPECT_EQ(counts[i], 1) << "task " << i;
+	}
+}
+
+TEST(WorkStealingPool, StartsNoMoreThreadsThanTasks) {
+	mutex m;
+	set<thread::id> ids;
+	vector<function<void()>> tasks;
+	for (int i = 0; i < 3; ++i) {
+		tasks.push_back([&] {
+			lock_guard<mutex> lock(m);
+			ids.insert(this_thread::get_id());
+		});
+	}
+
+	WorkStealingPool(100000).run(move(tasks));
+	EXPECT_GE(ids.size(), 1u);
+	EXPECT_LE(ids.size(), 3u);
+	WorkStealingPool(100000).run({});
+}
+
+TEST(BatchStripper, StripsDirectoryTreeIntoMirroredTreeDespiteFailures) {
+	namespace fs = std::filesystem;
+	fs::path root = fs::temp_directory_path() / "StripCppCommentsBatchTest";
+	fs::remove_all(root);
+	fs::create_directories(root / "src" / "sub");
+	ofstream(root / "src" / "a.cpp") << "int a; // comment\n";
+	ofstream(root / "src" / "sub" / "b.h") << "/* comment */int b;\n";
+	ofstream(root / "src" / "notes.txt") << "// not a C++ file\n";
+
+	fs::path oldCwd = fs::current_path();
+	fs::current_path(root);
+	auto files = collectBatchFiles({ "src", "missing.cpp" }, "out");
+	auto failures = stripFiles(files, 3);
+	fs::current_path(oldCwd);
+
+	ASSERT_EQ(failures.size(), 1);
+	EXPECT_EQ(failures[0].input, "missing.cpp");
+
+	auto slurp = [](const fs::path& path) { ostringstream oss; oss << ifstream(path).rdbuf(); return oss.str(); };
+	EXPECT_EQ(slurp(root / "out" / "src" / "a.cpp"), "int a; \n");
+	EXPECT_EQ(slurp(root / "out" / "src" / "sub" / "b.h"), " int b;\n");
+	EXPECT_FALSE(fs::exists(root / "out" / "src" / "notes.txt"));
+	fs::remove_all(root);
+}
+
+TEST(BatchStripper, RefusesToOverwriteInputsOrWriteOutsideOutputDirectory) {
+	namespace fs = std::filesystem;
+	fs::path root = fs::temp_directory_path() / "StripCppCommentsBatchOverwriteTest";
+	auto slurp = [](const fs::path& path) { ostringstream oss; oss << ifstream(path).rdbuf(); return oss.str(); };
+	for (BatchIo io : { BatchIo::BLOCKING, BatchIo::IO_URING }) {
+		fs::remove_all(root);
+		fs::create_directories(root / "work" / "src");
+		ofstream(root / "work" / "src" / "a.cpp") << "int a; // comment\n";
+		ofstream(root / "z.cpp") << "int z; // comment\n";
+
+		fs::path oldCwd = fs::current_path();
+		fs::current_path(root / "work");
+		auto inPlace = stripFiles(collectBatchFiles({ "src", "../z.cpp" }, "."), 2, nullptr, io);
+		auto outside = stripFiles(collectBatchFiles({ "../z.cpp" }, "out"), 2, nullptr, io);
+		fs::current_path(oldCwd);
+
+		ASSERT_EQ(inPlace.size(), 2);
+		EXPECT_EQ(inPlace[0].input, "../z.cpp");
+		EXPECT_EQ(inPlace[1].input, fs::path("src") / "a.cpp");
+		ASSERT_EQ(outside.size(), 1);
+		EXPECT_EQ(outside[0].input, "../z.cpp");
+		EXPECT_EQ(slurp(root / "work" / "src" / "a.cpp"), "int a; // comment\n");
+		EXPECT_EQ(slurp(root / "z.cpp"), "int z; // comment\n");
+		EXPECT_FALSE(fs::exists(root / "work" / "out"));
+	}
+
+	fs::remove_all(root);
+}
+
+TEST(CommentStripperClass, EverySplitPointGivesSameOutputAsWholeInput) {
+	string in = "a/\\\n* c *\\\n/b \"s\\\\\\\n\\\"//\" '\\'' //x\\\ny\nz /\\\n\\\n/ w\nR\"/*(//)/)/*\"//v\n/\\\r\n/u\r\r\n\\\r/";
+	string expected;
+	stripComments(in, expected);
+
+	CommentStripper stripper;
+	for (size_t i = 0; i <= in.size(); ++i) {
+		for (size_t j = i; j <= in.size(); ++j) {
+			string out;
+			stripper.feed(string_view(in).substr(0, i), out);
+			stripper.feed(string_view(in).substr(i, j - i), out);
+			stripper.feed(string_view(in).substr(j), out);
+			stripper.finish(out);
+			ASSERT_EQ(out, expected) << "split at " << i << " and " << j;
+		}
+	}
+}
+
+TEST(CommentStripperClass, ByteAtATimeOutputIsAppendedAsSoonAsKnown) {
+	CommentStripper stripper;
+	string out;
+	stripper.feed("int a; /", out);
+	EXPECT_EQ(out, "int a; ");	// The '/' may yet begin a comment
+	stripper.feed("/", out);
+	stripper.feed(" x", out);
+	EXPECT_EQ(out, "int a; ");
+	stripper.feed("\n", out);
+	EXPECT_EQ(out, "int a; \n");
+	stripper.feed("a /", out);
+	stripper.finish(out);
+	EXPECT_EQ(out, "int a; \na /");
+}
+
+TEST(CommentStripperClass, LineContinuationsAreAppendedAsSoonAsReadUnlessAfterSlash) {
+	CommentStripper stripper;
+	string out;
+	stripper.feed("a\\\n\\\r\n", out);
+	EXPECT_EQ(out, "a\\\n\\\r\n");
+	stripper.feed("\"s\\\n", out);
+	EXPECT_EQ(out, "a\\\n\\\r\n\"s\\\n");
+	stripper.feed("\" /\\\n\\\r\n", out);
+	EXPECT_EQ(out, "a\\\n\\\r\n\"s\\\n\" ");	// Line continuations after a '/' may yet be in a comment
+	stripper.feed("/ c\\\r\n", out);
+	EXPECT_EQ(out, "a\\\n\\\r\n\"s\\\n\" ");
+	stripper.feed("\n", out);
+	stripper.finish(out);
+	EXPECT_EQ(out, "a\\\n\\\r\n\"s\\\n\" \n");
+}
+
+TEST(OutputSink, SmallBufferPassesThroughRunsOfEverySize) {
+	ostringstream oss;
+	string expected;
+	{
+		OstreamOutputSink sink(oss, 4);
+		for (size_t n = 0; n < 12; ++n) {
+			string run(n, static_cast<char>('a' + n));
+			sink.append(run.data(), run.size());
+			sink.push_back('-');
+			expected += run + '-';
+			EXPECT_EQ(sink.size(), expected.size());
+		}
+
+		sink.flush();
+		EXPECT_EQ(oss.str(), expected);
+		sink.push_back('!');
+	}
+
+	EXPECT_EQ(oss.str(), expected + '!');	// Flushed on destruction
+}
+
+TEST(OutputSink, StreamOverloadMatchesOstreamOverload) {
+	string in = "int a; /* x */ // y\n\"//\" /\\\n/ z\n";
+	istringstream iss1(in), iss2(in);
+	ostringstream oss1, oss2;
+	stripComments(iss1, oss1);
+	{
+		OstreamOutputSink sink(oss2, 3);
+		stripComments(iss2, sink);
+		EXPECT_EQ(oss2.str(), oss1.str());	// Already flushed
+	}
+}
+
+TEST(OutputSink, WritevSinkInterleavesReferencedAndCopiedRunsInOrder) {
+	string mapped(20000, 'm');
+	for (size_t i = 0; i < mapped.size(); ++i) {
+		mapped[i] = static_cast<char>('a' + i % 26);
+	}
+
+	FILE* f = tmpfile();
+	ASSERT_NE(f, nullptr);
+	string expected;
+	{
+		WritevOutputSink sink(fileno(f), mapped.data(), mapped.data() + mapped.size(), 10);
+		for (size_t offset : { size_t(0), size_t(5000), size_t(5000), size_t(15000) }) {
+			sink.append(mapped.data() + offset, 5000);	// Long enough to be referenced, not copied
+			sink.push_back('|');
+			sink.append("\\\n", 2);
+			sink.append(mapped.data() + offset, 17);	// Too short to be referenced
+			expected += mapped.substr(offset, 5000) + "|\\\n" + mapped.substr(offset, 17);
+			EXPECT_EQ(sink.size(), expected.size());
+		}
+
+		sink.flush();
+	}
+
+	string written(expected.size() + 1, '\0');
+	rewind(f);
+	written.resize(fread(&written[0], 1, written.size(), f));
+	fclose(f);
+	EXPECT_EQ(written, expected);
+}
+
+TEST(SpscRing, DeliversEveryItemInOrderAcrossThreads) {
+	SpscRing<unsigned, 8> ring;
+	const unsigned n = 100000;
+	thread producer([&] {
+		for (unsigned i = 0; i < n; ++i) {
+			ring.push(i);
+		}
+	});
+
+	for (unsigned i = 0; i < n; ++i) {
+		ASSERT_EQ(ring.pop(), i);
+	}
+
+	producer.join();
+	unsigned dummy;
+	EXPECT_FALSE(ring.tryPop(dummy));
+}
+
+TEST(SpscRing, SleepingSideIsWokenByTheOther) {
+	SpscRing<unsigned, 2> ring;
+	for (unsigned round = 0; round < 100; ++round) {
+		thread consumer([&] {
+			EXPECT_EQ(ring.pop(), 3 * round);	// Waits long past its spins on an empty ring
+			this_thread::sleep_for(chrono::milliseconds(1));
+			EXPECT_EQ(ring.pop(), 3 * round + 1);
+			EXPECT_EQ(ring.pop(), 3 * round + 2);
+		});
+
+		this_thread::sleep_for(chrono::milliseconds(1));
+		ring.push(3 * round);
+		ring.push(3 * round + 1);
+		ring.push(3 * round + 2);	// Waits on a full ring
+		consumer.join();
+	}
+}
+
+TEST(CommentStripperPipelined, ManyBlocksMatchSequential) {
+	string in;
+	for (int i = 0; in.size() < 3 * 1024 * 1024; ++i) {
+		in += "int x" + to_string(i) + "; /* multi\\\nline */ s = \"//\"; /\\\n/ single\n";
+	}
+
+	istringstream iss1(in), iss2(in);
+	ostringstream oss1, oss2;
+	stripComments(iss1, oss1);
+	OstreamOutputSink sink(oss2);
+	stripCommentsPipelined(iss2, sink);
+	EXPECT_EQ(oss2.str(), oss1.str());
+}
+
+TEST(CommentStripperPipelined, ReadErrorIsRethrownWithoutHanging) {
+	struct FailingStreambuf : streambuf {
+		int_type underflow() override { throw runtime_error{"disk on fire"}; }
+	} failing;
+	istream is(&failing);
+	ostringstream oss;
+	OstreamOutputSink sink(oss);
+	EXPECT_THROW(stripCommentsPipelined(is, sink), runtime_error);
+}
+
+TEST(CommentStripperPipelined, WriteErrorStopsReading) {
+	struct LongStreambuf : streambuf {
+		char buffer[64 * 1024];
+		size_t nRead = 0;
+		int_type underflow() override {
+			if (nRead >= (size_t(1) << 30)) {
+				return traits_type::eof();
+			}
+
+			fill(buffer, buffer + sizeof buffer, 'x');
+			nRead += sizeof buffer;
+			setg(buffer, buffer, buffer + sizeof buffer);
+			return 'x';
+		}
+	} input;
+	struct FailingSink : OutputSink {
+		void write(const char*, size_t) override { throw runtime_error{"disk full"}; }
+	} sink;
+	istream is(&input);
+	EXPECT_THROW(stripCommentsPipelined(is, sink), runtime_error);
+	EXPECT_LT(input.nRead, size_t(64) << 20);
+}
+
+TEST(StripStats, CountsBytesInEachStateAndCommentsRemoved) {
+	string in = "x = \"s\"; // c\n/* m */\n";
+	string out;
+	StripStats stats;
+	stripComments(in, out, stats);
+
+	EXPECT_EQ(out, "x = \"s\"; \n \n");
+	EXPECT_EQ(stats.inputBytes, in.size());
+	EXPECT_EQ(stats.outputBytes, out.size());
+	EXPECT_EQ(stats.commentsRemoved, 2);
+	EXPECT_EQ(stats.continuationPairs, 0);
+	EXPECT_EQ(stats.bytesInState[static_cast<size_t>(State::NORMAL)], 10);
+	EXPECT_EQ(stats.bytesInState[static_cast<size_t>(State::IN_STRING)], 2);
+	EXPECT_EQ(stats.bytesInState[static_cast<size_t>(State::SLASH)], 2);
+	EXPECT_EQ(stats.bytesInState[static_cast<size_t>(State::IN_SINGLE_LINE_COMMENT)], 3);
+	EXPECT_EQ(stats.bytesInState[static_cast<size_t>(State::IN_MULTILINE_COMMENT)], 4);
+	EXPECT_EQ(stats.bytesInState[static_cast<size_t>(State::ASTERISK_IN_MULTILINE_COMMENT)], 1);
+}
+
+TEST(StripStats, StreamOverloadCountsContinuationsAcrossBlocksAndAccumulates) {
+	string block(64 * 1024 - 1, 'x');
+	string in = block + "/\\\n/ c\n" + block + "\\\n";
+	StripStats stats;
+	for (int i = 0; i < 2; ++i) {
+		istringstream iss(in);
+		ostringstream oss;
+		stripComments(iss, oss, stats);
+		EXPECT_EQ(oss.str(), block + "\n" + block + "\\\n");
+	}
+
+	uint64_t sum = 0;
+	for (uint64_t n : stats.bytesInState) {
+		sum += n;
+	}
+
+	EXPECT_EQ(stats.inputBytes, 2 * in.size());
+	EXPECT_EQ(sum, stats.inputBytes);
+	EXPECT_EQ(stats.commentsRemoved, 2);
+	EXPECT_EQ(stats.continuationPairs, 4);
+	EXPECT_EQ(stats.bytesInState[static_cast<size_t>(State::SLASH)], 2 * 3);
+}
+
+TEST(BatchStripper, IoUringAndBlockingBackEndsAgree) {
+	namespace fs = std::filesystem;
+	IoUring probe(2);
+	if (!probe.available()) {
+		GTEST_SKIP() << "io_uring unavailable: " << probe.unavailableReason();
+	}
+
+	fs::path root = fs::temp_directory_path() / "StripCppCommentsBatchIoTest";
+	fs::remove_all(root);
+	fs::create_directories(root / "in" / "sub");
+	vector<fs::path> inputs;
+	for (int i = 0; i < 100; ++i) {
+		fs::path path = root / "in" / (i % 2 ? "sub" : "") / ("f" + to_string(i) + ".h");
+		ofstream(path) << string(i * 97, 'x') << "/* " << i << " */ \"//\" // end\n";
+		inputs.push_back(path);
+	}
+	ofstream(root / "in" / "empty.h");
+	inputs.push_back(root / "in" / "empty.h");
+	inputs.push_back(root / "in" / "missing.h");
+
+	auto slurp = [](const fs::path& path) { ostringstream oss; oss << ifstream(path).rdbuf(); return oss.str(); };
+	vector<string> outputs[2];
+	for (BatchIo io : { BatchIo::BLOCKING, BatchIo::IO_URING }) {
+		fs::remove_all(root / "out");
+		vector<BatchFile> files;
+		for (const fs::path& input : inputs) {
+			files.push_back({ input, root / "out" / input.lexically_relative(root) });
+		}
+
+		vector<StripStats> stats;
+		uint64_t nSystemCalls = IoUring::nSystemCalls();
+		auto failures = stripFiles(files, 2, &stats, io);
+		EXPECT_EQ(IoUring::nSystemCalls() != nSystemCalls, io == BatchIo::IO_URING);	// Not quietly the blocking path
+		ASSERT_EQ(failures.size(), 1);
+		EXPECT_EQ(failures[0].input, root / "in" / "missing.h");
+		for (size_t i = 0; i + 1 < files.size(); ++i) {
+			outputs[io == BatchIo::IO_URING].push_back(slurp(files[i].output));
+			EXPECT_EQ(stats[i].inputBytes, fs::file_size(files[i].input));
+		}
+	}
+
+	EXPECT_EQ(outputs[1], outputs[0]);
+	EXPECT_EQ(outputs[0][3], string(3 * 97, 'x') + "  \"//\" \n");
+	fs::remove_all(root);
+}
+
+TEST(Xxh64, MatchesReferenceVectorsHoweverInputIsSplit) {
+	auto hash = [](const string& s, uint64_t seed = 0) { Xxh64 h(seed); h.append(s.data(), s.size()); return h.digest(); };
+	EXPECT_EQ(hash(""), 0xEF46DB3751D8E999ULL);
+	EXPECT_EQ(hash("a"), 0xD24EC4F1A98C6E5BULL);
+	EXPECT_EQ(hash("abc"), 0x44BC2CF5AD770999ULL);
+	string text = "Nobody inspects the spammish repetition";
+	EXPECT_EQ(hash(text), 0xFBCEA83C8A378BF1ULL);
+	EXPECT_NE(hash(text, 1), hash(text));
+
+	string longText;
+	for (int i = 0; i < 20; ++i) {
+		longText += text;
+	}
+
+	for (size_t split = 0; split <= longText.size(); split += 7) {
+		Xxh64 h;
+		h.append(longText.data(), split);
+		for (size_t i = split; i < longText.size(); ++i) {
+			h.push_back(longText[i]);
+		}
+
+		EXPECT_EQ(h.digest(), hash(longText)) << split;
+	}
+}
+
+TEST(StripCache, SecondBatchIsServedFromCacheByBothBackEnds) {
+	namespace fs = std::filesystem;
+	fs::path root = fs::temp_directory_path() / "StripCppCommentsCacheTest";
+	fs::remove_all(root);
+	fs::create_directories(root / "in");
+	vector<BatchFile> files;
+	for (int i = 0; i < 20; ++i) {
+		fs::path path = root / "in" / ("f" + to_string(i) + ".h");
+		ofstream(path) << "int x" << i % 10 << "; // " << i << "\n";	// Pairs of files have the same output, but not input
+		files.push_back({ path, root / "out" / path.filename() });
+	}
+
+	auto slurp = [](const fs::path& path) { ostringstream oss; oss << ifstream(path).rdbuf(); return oss.str(); };
+	StripCache cache(root / "cache", 1024 * 1024);
+	ASSERT_TRUE(stripFiles(files, 2, nullptr, BatchIo::BLOCKING, &cache).empty());
+	EXPECT_EQ(cache.nHits(), 0);
+	EXPECT_EQ(cache.nMisses(), 20);
+
+	for (BatchIo io : { BatchIo::BLOCKING, BatchIo::IO_URING }) {
+		fs::remove_all(root / "out");
+		ofstream(files[0].input) << "int changed; /* */\n";
+		vector<StripStats> stats;
+		ASSERT_TRUE(stripFiles(files, 2, &stats, io, &cache).empty());
+		EXPECT_EQ(slurp(files[0].output), "int changed;  \n");
+		EXPECT_EQ(slurp(files[13].output), "int x3; \n");
+		EXPECT_EQ(stats[13].inputBytes, fs::file_size(files[13].input));
+		EXPECT_EQ(stats[13].outputBytes, 9);
+	}
+
+	EXPECT_EQ(cache.nHits(), 2 * 19 + 1);	// The changed file is a miss only the first time
+	EXPECT_EQ(cache.nMisses(), 20 + 1);
+	EXPECT_NE(StripCache::key("int x;"), StripCache::key("int x;", "some option"));
+	fs::remove_all(root);
+}
+
+TEST(StripCache, EvictsLeastRecentlyUsedEntriesBeyondMaxSize) {
+	namespace fs = std::filesystem;
+	fs::path root = fs::temp_directory_path() / "StripCppCommentsCacheEvictionTest";
+	fs::remove_all(root);
+	StripCache cache(root, 3500);
+	string entry(1000, 'x');
+	for (string key : { "a", "b", "c" }) {
+		cache.insert(StripCache::key(key), entry);
+	}
+
+	// Make them all equally old, then use all but "b"
+	auto past = fs::file_time_type::clock::now() - chrono::hours(1);
+	for (const auto& file : fs::recursive_directory_iterator(root)) {
+		if (file.is_regular_file()) {
+			fs::last_write_time(file.path(), past);
+		}
+	}
+
+	string out;
+	ASSERT_TRUE(cache.fetch(StripCache::key("a"), out));
+	ASSERT_TRUE(cache.fetch(StripCache::key("c"), out));
+	cache.insert(StripCache::key("d"), entry);
+	cache.evict();
+
+	for (string key : { "a", "c", "d" }) {
+		out.clear();
+		EXPECT_TRUE(cache.fetch(StripCache::key(key), out)) << key;
+		EXPECT_EQ(out, entry);
+	}
+	EXPECT_FALSE(cache.fetch(StripCache::key("b"), out));
+	fs::remove_all(root);
+}
+
+TEST(Fingerprint, HashesStrippedOutputWithoutStoringIt) {
+	string in = "int a; /* x */ // y\n\"/* in a string */\" \\\n/";
+	string out;
+	stripComments(in, out);
+	Xxh64 expected;
+	expected.append(out.data(), out.size());
+	EXPECT_EQ(fingerprint(in), expected.digest());
+	istringstream iss(in);
+	EXPECT_EQ(fingerprint(iss), expected.digest());
+
+	EXPECT_EQ(fingerprint("int a; // Comment\n"), fingerprint("int a; // Changed comment\n"));
+	EXPECT_NE(fingerprint("int a; // Comment\n"), fingerprint("int b; // Comment\n"));
+}
+
+TEST(Fingerprint, BatchMatchesSingleAndReportsFailures) {
+	namespace fs = std::filesystem;
+	fs::path root = fs::temp_directory_path() / "StripCppCommentsFingerprintTest";
+	fs::remove_all(root);
+	fs::create_directories(root);
+	vector<fs::path> inputs;
+	vector<string> contents;
+	for (int i = 0; i < 10; ++i) {
+		inputs.push_back(root / ("f" + to_string(i) + ".h"));
+		contents.push_back(string(i * 1000, 'x') + "/* " + to_string(i) + " */\n");
+		ofstream(inputs.back()) << contents.back();
+	}
+	inputs.push_back(root / "missing.h");
+
+	vector<uint64_t> digests;
+	auto failures = fingerprintFiles(inputs, 3, digests);
+	ASSERT_EQ(failures.size(), 1);
+	EXPECT_EQ(failures[0].input, root / "missing.h");
+	for (size_t i = 0; i < contents.size(); ++i) {
+		EXPECT_EQ(digests[i], fingerprint(contents[i])) << i;
+	}
+	EXPECT_EQ(digests.back(), 0);
+	fs::remove_all(root);
+}
+
+TEST(Compare, InputsDifferingOnlyInCommentsAreSame) {
+	istringstream a("int a; // One comment\nint b; /* x */\n"), b("int a; // Another\nint b; /* yz */\n");
+	EXPECT_FALSE(findFirstDifference(a, b));
+}
+
+TEST(Compare, ReportsFirstDifferenceInBothInputs) {
+	istringstream a("int a; // One\nint b;\n"), b("int a; // Another one\nint c;\n");
+	auto difference = findFirstDifference(a, b);
+	ASSERT_TRUE(difference);
+	EXPECT_EQ(difference->a.offset, 18);
+	EXPECT_EQ(difference->a.line, 2);
+	EXPECT_EQ(difference->a.column, 5);
+	EXPECT_EQ(difference->b.offset, 26);
+	EXPECT_EQ(difference->b.line, 2);
+	EXPECT_EQ(difference->b.column, 5);
+}
+
+TEST(Compare, InputWhoseOutputEndsFirstIsLocatedAtItsEnd) {
+	istringstream a("int a;\n"), b("int a;\n// Comment\nint b;\n");
+	auto difference = findFirstDifference(a, b);
+	ASSERT_TRUE(difference);
+	EXPECT_EQ(difference->a.offset, 7);
+	EXPECT_EQ(difference->a.line, 2);
+	EXPECT_EQ(difference->a.column, 1);
+	EXPECT_EQ(difference->b.offset, 17);	// The newline ending the comment
+	EXPECT_EQ(difference->b.line, 2);
+	EXPECT_EQ(difference->b.column, 11);
+}
+
+TEST(Compare, FindsDifferenceManyBlocksIn) {
+	string a = "/* A */\n", b = "/* A longer header */\n";
+	for (int i = 0; i < 20000; ++i) {
+		a += "int x = 1; // Some comment\n";
+		b += "int x = 1; // Other\n";
+	}
+
+	for (bool differ : { false, true }) {
+		istringstream aStream(a + "int y;\n"), bStream(b + (differ ? "int z;\n" : "int y;\n"));
+		auto difference = findFirstDifference(aStream, bStream);
+		ASSERT_EQ(difference.has_value(), differ);
+		if (differ) {
+			EXPECT_EQ(difference->a.offset, a.size() + 4);
+			EXPECT_EQ(difference->a.line, 20002);
+			EXPECT_EQ(difference->a.column, 5);
+			EXPECT_EQ(difference->b.offset, b.size() + 4);
+			EXPECT_EQ(difference->b.line, 20002);
+			EXPECT_EQ(difference->b.column, 5);
+		}
+	}
+}
+
+TEST(FindFirstComment, IgnoresCommentMarkersInLiterals) {
+	EXPECT_FALSE(findFirstComment("s = \"// /* \"; c = '/'; d = a / b;\n"));
+	EXPECT_FALSE(findFirstComment(""));
+	istringstream iss("x = 1 / 2;");
+	EXPECT_FALSE(findFirstComment(iss));
+}
+
+TEST(FindFirstComment, LocatesFirstSlashOfFirstComment) {
+	auto location = findFirstComment("int a;\nint b; /\\\n* c */ // d\n");
+	ASSERT_TRUE(location);
+	EXPECT_EQ(location->offset, 14);
+	EXPECT_EQ(location->line, 2);
+	EXPECT_EQ(location->column, 8);
+}
+
+TEST(FindFirstComment, CommentSplitAcrossBlocksIsLocatedInBothOverloads) {
+	string lines;
+	while (lines.size() < 64 * 1024 - 100) {
+		lines += "int x;\n";
+	}
+
+	size_t nLines = count(lines.begin(), lines.end(), '\n');
+	for (size_t padding = 90; padding < 110; ++padding) {
+		string in = lines + string(padding, ' ') + "/\\\n\\\n/ Comment\n";
+		uint64_t slash = lines.size() + padding;
+		auto location = findFirstComment(in);
+		ASSERT_TRUE(location) << padding;
+		EXPECT_EQ(location->offset, slash) << padding;
+		EXPECT_EQ(location->line, nLines + 1) << padding;
+		EXPECT_EQ(location->column, padding + 1) << padding;
+
+		istringstream iss(in);
+		auto streamLocation = findFirstComment(iss);
+		ASSERT_TRUE(streamLocation) << padding;
+		EXPECT_EQ(streamLocation->offset, slash) << padding;
+		EXPECT_EQ(streamLocation->line, nLines + 1) << padding;
+	}
+}
+
+TEST(FindFirstComment, BatchReportsEachFile) {
+	namespace fs = std::filesystem;
+	fs::path root = fs::temp_directory_path() / "StripCppCommentsHasCommentsTest";
+	fs::remove_all(root);
+	fs::create_directories(root);
+	ofstream(root / "a.h") << "int a;\n";
+	ofstream(root / "b.h") << "int b;\n\n  /* b */\n";
+	vector<fs::path> inputs{ root / "a.h", root / "b.h", root / "missing.h" };
+	vector<optional<SourceLocation>> locations;
+	auto failures = findFirstComments(inputs, 2, locations);
+	ASSERT_EQ(failures.size(), 1);
+	EXPECT_EQ(failures[0].input, root / "missing.h");
+	EXPECT_FALSE(locations[0]);
+	ASSERT_TRUE(locations[1]);
+	EXPECT_EQ(locations[1]->line, 3);
+	EXPECT_EQ(locations[1]->column, 3);
+	EXPECT_FALSE(locations[2]);
+	fs::remove_all(root);
+}
+
+TEST(IncrementalStripper, RandomEditsKeepOutputEqualToFullStrip) {
+	const char* fragments[] = { "int x;\n", "// c\n", "/* a\n b */", "\"s // \\\" \"", "'\\''", "\\\n", "/", "*", "\n", " ",
+		"R\"x(", ")x\"", "\\\r\n", "\r\n", "\r" };
+	mt19937 rng(42);
+	string text;
+	for (int i = 0; i < 2000; ++i) {
+		text += fragments[rng() % size(fragments)];
+	}
+
+	IncrementalStripper incremental(text, 64);
+	for (int i = 0; i < 1000; ++i) {
+		size_t offset = rng() % (text.size() + 1);
+		size_t removedLength = min<size_t>(rng() % 8, text.size() - offset);
+		string inserted = rng() % 3 ? fragments[rng() % size(fragments)] : "";
+		string oldOutput = incremental.output();
+		auto change = incremental.edit(offset, removedLength, inserted);
+		text.replace(offset, removedLength, inserted);
+
+		string expected;
+		stripComments(text, expected);
+		ASSERT_EQ(incremental.input(), text) << i;
+		ASSERT_EQ(incremental.output(), expected) << i;
+		ASSERT_EQ(oldOutput.replace(change.offset, change.removedLength, expected, change.offset, change.insertedLength), expected) << i;
+	}
+
+	EXPECT_THROW(incremental.edit(text.size() + 1, 0, "x"), out_of_range);
+	EXPECT_THROW(incremental.edit(text.size() - 1, 2, ""), out_of_range);
+}
+
+TEST(IncrementalStripper, EditReStripsOnlyUntilStatesReconverge) {
+	string text;
+	for (int i = 0; i < 10000; ++i) {
+		text += "int x" + to_string(i) + "; // Comment\n";
+	}
+
+	IncrementalStripper incremental(text, 1024);
+	size_t middle = text.size() / 2;
+	auto change = incremental.edit(middle, 0, "y");
+	EXPECT_LT(change.removedLength, 4096);
+	EXPECT_EQ(change.insertedLength, change.removedLength + 1);
+
+	// Opening a multiline comment swallows everything up to the next "*/", so the rest must be re-stripped
+	change = incremental.edit(middle, 1, "/*");
+	EXPECT_EQ(change.offset + change.insertedLength, incremental.output().size());
+	string expected;
+	stripComments(incremental.input(), expected);
+	EXPECT_EQ(incremental.output(), expected);
+}
+
+TEST(OffsetMap, DescribesKeptDroppedAndReplacedRuns) {
+	string in = "a/*x*/b// c\n/d";
+	string out;
+	OffsetMap map;
+	stripComments(in, out, map);
+	ASSERT_EQ(out, "a b\n/d");
+	EXPECT_EQ(map.inputSize(), in.size());
+	EXPECT_EQ(map.outputSize(), out.size());
+	EXPECT_EQ(map.nRuns(), 5);
+
+	auto run = map.runAtInput(3);
+	EXPECT_EQ(run.kind, OffsetMap::Kind::REPLACED);
+	EXPECT_EQ(run.inputOffset, 1);
+	EXPECT_EQ(run.inputLength, 5);
+	EXPECT_EQ(run.outputOffset, 1);
+	run = map.runAtInput(8);
+	EXPECT_EQ(run.kind, OffsetMap::Kind::DROPPED);
+	EXPECT_EQ(run.inputOffset, 7);
+	EXPECT_EQ(run.inputLength, 4);
+	run = map.runAtOutput(4);	// The '/' held back until the 'd' showed it begins no comment
+	EXPECT_EQ(run.kind, OffsetMap::Kind::KEPT);
+	EXPECT_EQ(run.inputOffset, 11);
+	EXPECT_EQ(run.inputLength, 3);
+
+	EXPECT_EQ(map.toOutput(3), 1);
+	EXPECT_EQ(map.toOutput(8), 3);
+	EXPECT_EQ(map.toOutput(in.size()), out.size());
+	EXPECT_EQ(map.toInput(1), 1);
+	EXPECT_EQ(map.toInput(4), 12);
+	EXPECT_EQ(map.toInput(out.size()), in.size());
+	EXPECT_THROW(map.runAtInput(in.size()), out_of_range);
+	EXPECT_THROW(map.runAtOutput(out.size()), out_of_range);
+}
+
+TEST(OffsetMap, RandomInputsMapEveryByte) {
+	const char* fragments[] = { "int x;\n", "// c\n", "/* a\n b */", "\"s // \\\" \"", "'\\''", "\\\n", "/", "*", "\n", " ",
+		"R\"x(", ")x\"", "\\\r\n", "\r\n", "\r" };
+	mt19937 rng(7);
+	for (int trial = 0; trial < 50; ++trial) {
+		string in;
+		for (int i = 0, n = rng() % 2000; i < n; ++i) {
+			in += fragments[rng() % size(fragments)];
+		}
+
+		string out;
+		OffsetMap map;
+		stripComments(in, out, map);
+		string expected;
+		stripComments(in, expected);
+		ASSERT_EQ(out, expected);
+		ASSERT_EQ(map.inputSize(), in.size());
+		ASSERT_EQ(map.outputSize(), out.size());
+
+		// Walk the runs, checking each against the input and output, and that the decoded map agrees
+		OffsetMap decoded(map.encoded());
+		ASSERT_EQ(decoded.encoded(), map.encoded());
+		size_t nRuns = 0;
+		for (uint64_t i = 0, o = 0; i < in.size(); ++nRuns) {
+			auto run = map.runAtInput(i);
+			ASSERT_EQ(run.inputOffset, i);
+			ASSERT_EQ(run.outputOffset, o);
+			if (run.kind == OffsetMap::Kind::KEPT) {
+				string_view kept = string_view(in).substr(i, run.inputLength);
+				ASSERT_EQ(string_view(out).substr(o, run.outputLength), kept) << trial;
+				ASSERT_EQ(map.toInput(o + run.outputLength - 1), i + run.inputLength - 1);
+			} else if (run.kind == OffsetMap::Kind::REPLACED) {
+				ASSERT_EQ(out[o], ' ');
+				ASSERT_EQ(in[i], '/');
+				ASSERT_EQ(map.toInput(o), i);
+			}
+
+			auto other = decoded.runAtInput(i + run.inputLength - 1);
+			ASSERT_EQ(other.inputOffset, run.inputOffset);
+			ASSERT_EQ(other.outputOffset, run.outputOffset);
+			ASSERT_EQ(other.kind, run.kind);
+			i += run.inputLength;
+			o += run.outputLength;
+		}
+		ASSERT_EQ(nRuns, map.nRuns());
+
+		stringstream is(in);
+		ostringstream os;
+		OstreamOutputSink sink(os);
+		OffsetMap streamed;
+		stripComments(is, sink, streamed);
+		ASSERT_EQ(os.str(), out);
+		ASSERT_EQ(streamed.encoded(), map.encoded());
+	}
+
+	EXPECT_THROW(OffsetMap(string_view("\x80", 1)), runtime_error);
+	EXPECT_THROW(OffsetMap(string_view("\x03", 1)), runtime_error);
+}
+
+namespace {
+	struct ExtractedComment {
+		SourceLocation start;
+		string text;
+	};
+
+	class CollectingCommentSink : public CommentSink {
+	public:
+		vector<ExtractedComment> comments;
+		size_t nEnded = 0;
+
+		void beginComment(const SourceLocation& start) override { comments.push_back({ start, "" }); }
+		void append(const char* p, size_t n) override { comments.back().text.append(p, n); }
+		void endComment() override { ++nEnded; }
+	};
+}
+
+TEST(CommentSink, ReceivesEachCommentWithItsLocation) {
+	string in = "a; // one\nb = \"// no\"; /* two\n lines */ c;\n\t/\\\n/ three\r\n/**/";
+	string out;
+	CollectingCommentSink sink;
+	stripComments(in, out, sink);
+	string expected;
+	stripComments(in, expected);
+	EXPECT_EQ(out, expected);
+
+	ASSERT_EQ(sink.comments.size(), 4);
+	EXPECT_EQ(sink.nEnded, 4);
+	EXPECT_EQ(sink.comments[0].text, "// one");
+	EXPECT_EQ(sink.comments[0].start.offset, 3);
+	EXPECT_EQ(sink.comments[0].start.line, 1);
+	EXPECT_EQ(sink.comments[0].start.column, 4);
+	EXPECT_EQ(sink.comments[1].text, "/* two\n lines */");
+	EXPECT_EQ(sink.comments[1].start.offset, 23);
+	EXPECT_EQ(sink.comments[1].start.line, 2);
+	EXPECT_EQ(sink.comments[1].start.column, 14);
+	EXPECT_EQ(sink.comments[2].text, "/\\\n/ three");	// The CR stays with the newline in the output
+	EXPECT_EQ(sink.comments[2].start.offset, 44);
+	EXPECT_EQ(sink.comments[2].start.line, 4);
+	EXPECT_EQ(sink.comments[2].start.column, 2);
+	EXPECT_EQ(sink.comments[3].text, "/**/");
+	EXPECT_EQ(sink.comments[3].start.offset, 56);
+	EXPECT_EQ(sink.comments[3].start.line, 6);
+	EXPECT_EQ(sink.comments[3].start.column, 1);
+}
+
+TEST(CommentSink, RandomInputsGiveEveryCommentFromEveryOverload) {
+	const char* fragments[] = { "int x;\n", "// c\n", "/* a\n b */", "\"s // \\\" \"", "'\\''", "\\\n", "/", "*", "\n", " ",
+		"R\"x(", ")x\"", "\\\r\n", "\r\n", "\r" };
+	mt19937 rng(11);
+	for (int trial = 0; trial < 50; ++trial) {
+		string in;
+		for (int i = 0, n = (trial == 0 ? 40000 : rng() % 2000); i < n; ++i) {	// The first spans several stream blocks
+			in += fragments[rng() % size(fragments)];
+		}
+
+		string out;
+		CollectingCommentSink sink;
+		StripStats stats;
+		stripComments(in, out, sink, stats);
+		string expected;
+		stripComments(in, expected);
+		ASSERT_EQ(out, expected);
+		ASSERT_EQ(sink.comments.size(), stats.commentsRemoved);
+		ASSERT_EQ(sink.nEnded, sink.comments.size());
+
+		// Each comment's text is the input at its location
+		for (const auto& comment : sink.comments) {
+			uint64_t offset = comment.start.offset;
+			ASSERT_EQ(string_view(in).substr(offset, comment.text.size()), comment.text) << trial;
+			ASSERT_EQ(comment.start.line, 1 + count(in.begin(), in.begin() + offset, '\n'));
+			size_t lineStart = string_view(in).substr(0, offset).rfind('\n') + 1;	// 0 if there is no newline
+			ASSERT_EQ(comment.start.column, offset - lineStart + 1);
+		}
+
+		stringstream is(in);
+		ostringstream os;
+		OstreamOutputSink streamSink(os);
+		CollectingCommentSink streamed;
+		stripComments(is, streamSink, streamed);
+		ASSERT_EQ(os.str(), out);
+		ASSERT_EQ(streamed.comments.size(), sink.comments.size());
+		for (size_t i = 0; i < sink.comments.size(); ++i) {
+			ASSERT_EQ(streamed.comments[i].text, sink.comments[i].text);
+			ASSERT_EQ(streamed.comments[i].start.offset, sink.comments[i].start.offset);
+			ASSERT_EQ(streamed.comments[i].start.line, sink.comments[i].start.line);
+			ASSERT_EQ(streamed.comments[i].start.column, sink.comments[i].start.column);
+		}
+	}
+}
+
+TEST(StripMode, PreserveLinesReplacesCommentsWithTheirLineBreaks) {
+	string in = "a; // one\nb /* two\n lines */ c;\r\n/\\\n/ x\\\r\ny\nd/**/e";
+	string out;
+	stripComments(in, out, StripMode::PRESERVE_LINES);
+	EXPECT_EQ(out, "a; \nb \n  c;\r\n\n\r\n\nd e");
+}
+
+TEST(StripMode, PreserveColumnsReplacesCommentsWithSpaces) {
+	string in = "a; // one\nb /* two\n\tlines */ c;\n/\\\n/ x\\\r\ny\nd/**/e";
+	string out;
+	stripComments(in, out, StripMode::PRESERVE_COLUMNS);
+	EXPECT_EQ(out, "a;       \nb       \n\t         c;\n  \n    \r\n \nd    e");
+}
+
+TEST(StripMode, KeepDocCommentsKeepsOnlyDocComments) {
+	string in = "/// doc\nint a; // not\n/** block */ int b; /**/ int c; /* x */\n//// also\n/\\\n**\\\n\n* split\n */ d;";
+	string out;
+	stripComments(in, out, StripMode::KEEP_DOC_COMMENTS);
+	EXPECT_EQ(out, "/// doc\nint a; \n/** block */ int b;   int c;  \n//// also\n/\\\n**\\\n\n* split\n */ d;");
+}
+
+TEST(StripMode, RandomInputsKeepEachModesPromiseInEveryOverload) {
+	const char* fragments[] = { "int x;\n", "// c\n", "/* a\n b */", "\"s // \\\" \"", "'\\''", "\\\n", "/", "*", "\n", " ",
+		"R\"x(", ")x\"", "\\\r\n", "\r\n", "\r", "/// d\n", "/** d */", "\t" };
+	mt19937 rng(13);
+	for (int trial = 0; trial < 50; ++trial) {
+		string in;
+		for (int i = 0, n = (trial == 0 ? 40000 : rng() % 2000); i < n; ++i) {	// The first spans several stream blocks
+			in += fragments[rng() % size(fragments)];
+		}
+
+		string stripped;
+		stripComments(in, stripped);
+		for (StripMode mode : { StripMode::DROP_COMMENTS, StripMode::PRESERVE_LINES, StripMode::PRESERVE_COLUMNS, StripMode::KEEP_DOC_COMMENTS }) {
+			string out;
+			stripComments(in, out, mode);
+			if (mode == StripMode::DROP_COMMENTS) {
+				ASSERT_EQ(out, stripped);
+			} else if (mode == StripMode::PRESERVE_LINES) {
+				ASSERT_EQ(count(out.begin(), out.end(), '\n'), count(in.begin(), in.end(), '\n')) << trial;
+			} else if (mode == StripMode::PRESERVE_COLUMNS) {
+				ASSERT_EQ(out.size(), in.size()) << trial;
+				for (size_t i = 0; i < in.size(); ++i) {
+					ASSERT_TRUE(out[i] == in[i] || out[i] == ' ') << trial << ' ' << i;
+				}
+			} else {
+				string restripped;	// Doc comments are kept as they were, where they were
+				stripComments(out, restripped);
+				ASSERT_EQ(restripped, stripped) << trial;
+			}
+
+			stringstream is(in);
+			ostringstream os;
+			OstreamOutputSink sink(os);
+			stripComments(is, sink, mode);
+			ASSERT_EQ(os.str(), out) << trial;
+		}
+	}
+}
+
+TEST(StripAndMinify, KeepsOnlyWhitespaceThatSeparatesTokensOrEndsDirectives) {
+	string in =
+		"  #  include <foo.h>\n"
+		"#define f (x)   /* c\n  spans */ + 1\n"
+		"#define LONG a \\\n   b\n"
+		"\n"
+		"int   main ( )  {   // hi\n"
+		"\treturn a + +b - -c + 1e + 5 + 1 .5 ;\r\n"
+		"\n"
+		"\tauto s = u8 \"a  b\" \"c\" s + R\"x(  raw\n  )x\" ;  ' ' ;\n"
+		"  i\\\nnt q ;\n"
+		"}\n";
+	string out;
+	stripAndMinify(in, out);
+	EXPECT_EQ(out,
+		"# include <foo.h>\n"
+		"#define f (x) + 1\n"
+		"#define LONG a b\n"
+		"int main(){return a+ +b- -c+1e +5+1 .5;auto s=u8 \"a  b\"\"c\" s+R\"x(  raw\n  )x\";' ';int q;}\n");
+}
+
+TEST(StripAndMinify, RandomInputsChangeOnlyWhitespaceAndContinuationsInEveryOverload) {
+	const char* fragments[] = { "int x;\n", "// c\n", "/* a\n b */", "\"s // \\\" \"", "'\\''", "\\\n", "/", "*", "\n", " ",
+		"R\"x(", ")x\"", "\\\r\n", "\r\n", "\r", "\t", "#define y 1\n", "a", "+", "." };
+	mt19937 rng(17);
+	auto withoutWhitespace = [](string s) {
+		s.erase(remove_if(s.begin(), s.end(), [](char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\\'; }), s.end());
+		return s;
+	};
+
+	for (int trial = 0; trial < 50; ++trial) {
+		string in;
+		for (int i = 0, n = (trial == 0 ? 40000 : rng() % 2000); i < n; ++i) {	// The first spans several stream blocks
+			in += fragments[rng() % size(fragments)];
+		}
+
+		string out;
+		stripAndMinify(in, out);
+		string stripped;
+		stripComments(in, stripped);
+		ASSERT_EQ(withoutWhitespace(out), withoutWhitespace(stripped)) << trial;
+		ASSERT_LE(out.size(), stripped.size() + 1) << trial;	// Plus a newline, if stripped ends in a directive that doesn't
+
+		string again;
+		stripAndMinify(out, again);
+		ASSERT_EQ(again, out) << trial;
+
+		stringstream is(in);
+		ostringstream os;
+		OstreamOutputSink sink(os);
+		stripAndMinify(is, sink);
+		ASSERT_EQ(os.str(), out) << trial;
+	}
+}
+
+// Tests that would fail if "DISABLED_" were removed from their names, due to limitations in the code
+
 // Since C++14, numeric literals can be written with single-quote digit separators, like 1'234.
 TEST(CommentStripper, DISABLED_QuotesInNumericLiteralsDoNotHideComments) {
 	istringstream iss(
@@ -548,32 +1850,6 @@ TEST(CommentStripper, DISABLED_QuotesInNumericLiteralsDoNotHideComments) {
 	);
 }
 
-// On Windows, file-based streams default to text mode, with \r\n pairs translated to \n on input and back again
-// on output. Although it would be possible to preserve all \r characters exactly while treating both <backslash><newline>
-// and <backslash><carriage_return><newline> as line continuations, this would complicate the logic; also, doing this
-// requires either the ability to seek arbitrarily far back in the input stream (ruling out use in a pipeline) or an
-// unbounded amount of memory, because of the following input scenario:
-//
-//     A slash, followed by a large number of consecutive line continuations, each being either <backslash><newline> or
-//     <backslash><carriage_return><newline>, followed by some non-backslash character X.
-// 
-// If X is a slash or asterisk, a comment has begun and we must discard all these characters; if it is
-// any other character, we must print them all out. This means that we must either remember the location of the original
-// slash in the input and seek back to it when we see X, or buffer the entire sequence in memory until we see X.
-//
-// The approach taken here is to rely on the default text translation mode, which on Windows will detect both types
-// of line continuation but will translate all bare newlines to \r\n pairs, and on other platforms will ignore
-// line continuations containing carriage returns.
-TEST(CommentStripper, DISABLED_HandlesCarriageReturnInLineContinuation) {
-	istringstream iss(
-		"// Comment split into 2 lines using\\\r\n"
-		" a line continuation containing a carriage return"
-	);
-	ostringstream oss;
-	stripComments(iss, oss);
-	EXPECT_STREQ(oss.str().c_str(), "");
-}
-
 // Before C++17, trigraphs should be changed to their corresponding single characters (e.g., "??/" => "\"), and
 // this happens even before line continuation.
 TEST(CommentStripper, DISABLED_HandlesLineTrigrahInLineContinuation) {